@@ -16,6 +16,15 @@ def gen_uniform_boxes(n, rng):
         yield rtse.Box2(rtse.Point2(x1, y1), rtse.Point2(x2, y2))
 
 
+# near-uniform 1 x 1 boxes: small enough that the grid tuner picks real
+# cells instead of the single cell it keeps for gen_uniform_boxes()
+def gen_uniform_points(n, rng):
+    for _ in range(n):
+        x = rng.uniform(COORD_MIN, COORD_MAX)
+        y = rng.uniform(COORD_MIN, COORD_MAX)
+        yield rtse.Box2(rtse.Point2(x, y), rtse.Point2(x + 1, y + 1))
+
+
 def gen_data_and_queries(N, Q, win_frac, seed=314551132):
     rng = random.Random(seed)
     data = [(box, id) for id, box in enumerate(gen_uniform_boxes(N, rng))]
@@ -30,6 +39,13 @@ def build_index(pairs):
     return tree
 
 
+def build_grid_index(pairs):
+    grid = rtse.GridIndex()
+    for box, id in pairs:
+        grid.insert(box, id)
+    return grid
+
+
 def linear_scan_ids(data, query_box):
     hits = []
     for box, id in data:
@@ -141,6 +157,32 @@ def test_query_fixed_win_1pct(benchmark, N):
         f"mean={mean_s*1e3:.3f} ms  median={median_s*1e3:.3f} ms  QPS≈{qps:.1f}"
     )
 
+@pytest.mark.parametrize("N", [5_000, 10_000, 20_000, 40_000, 80_000])
+def test_grid_fixed_win_1pct(benchmark, N):
+    Q = 1_000
+    win_frac = 0.01
+
+    data, queries = gen_data_and_queries(N, Q, win_frac)
+    grid = build_grid_index(data)
+    it = cycle(queries)
+
+    for _ in range(200):
+        _ = grid.query_range(next(it))
+
+    def run_one():
+        return len(grid.query_range(next(it)))
+
+    benchmark(run_one)
+    st = benchmark.stats.stats
+
+    mean_s = st.mean
+    median_s = st.median
+    qps = 1.0 / mean_s if mean_s > 0 else float("inf")
+    print(
+        f"\n[fixed-win grid] N={N} Q={Q} win=1% cells={grid.columns}x{grid.rows} "
+        f"mean={mean_s*1e3:.3f} ms  median={median_s*1e3:.3f} ms  QPS≈{qps:.1f}"
+    )
+
 @pytest.mark.parametrize("N", [5_000, 10_000, 20_000, 40_000, 80_000])
 def test_linear_fixed_win_1pct(benchmark, N):
     Q = 1_000
@@ -166,6 +208,39 @@ def test_linear_fixed_win_1pct(benchmark, N):
         f"mean={mean_s*1e3:.3f} ms  median={median_s*1e3:.3f} ms  QPS≈{qps:.1f}"
     )
 
+@pytest.mark.parametrize("N", [5_000, 10_000, 20_000, 40_000, 80_000])
+@pytest.mark.parametrize("kind", ["rtree", "grid"])
+def test_points_fixed_win_1pct(benchmark, kind, N):
+    Q = 1_000
+    win_frac = 0.01
+
+    rng = random.Random(314551132)
+    data = [(box, id) for id, box in enumerate(gen_uniform_points(N, rng))]
+    queries = [rand_query(win_frac, rng) for _ in range(Q)]
+    index = build_index(data) if kind == "rtree" else build_grid_index(data)
+    if kind == "grid":
+        assert index.columns > 1 and index.rows > 1
+    it = cycle(queries)
+
+    for _ in range(200):
+        _ = index.query_range(next(it))
+
+    def run_one():
+        return len(index.query_range(next(it)))
+
+    benchmark(run_one)
+    st = benchmark.stats.stats
+
+    mean_s = st.mean
+    median_s = st.median
+    qps = 1.0 / mean_s if mean_s > 0 else float("inf")
+    cells = f" cells={index.columns}x{index.rows}" if kind == "grid" else ""
+    print(
+        f"\n[points {kind}] N={N} Q={Q} win=1%{cells} "
+        f"mean={mean_s*1e3:.3f} ms  median={median_s*1e3:.3f} ms  QPS≈{qps:.1f}"
+    )
+
+
 @pytest.mark.parametrize(
     "N_active, steps",
     [
@@ -218,3 +293,80 @@ def test_mixed_workload_scaling(benchmark, N_active, steps):
         f"\n[mixed] N={N_active} steps={steps} "
         f"mean={mean_s*1e3:.3f} ms  median={median_s*1e3:.3f} ms  OPS≈{ops:.1f}"
     )
+
+@pytest.fixture(scope="module")
+def disk_index_files(tmp_path_factory):
+    """One 100k-box disk index per page size, shared by the cache sweeps."""
+    data, _ = gen_data_and_queries(100_000, 0, 0.01)
+    files = {}
+    for page_size in (4096, 16384):
+        path = str(tmp_path_factory.mktemp("disk") / f"index_{page_size}")
+        disk = rtse.DiskRTree(path, page_size=page_size)
+        for box, id in data:
+            disk.insert(box, id)
+        disk.flush()
+        files[page_size] = path
+    return files
+
+
+@pytest.mark.parametrize("page_size", [4096, 16384])
+@pytest.mark.parametrize("cache_kib", [64, 1024, 16384])
+def test_disk_page_reads_per_query(benchmark, disk_index_files, page_size, cache_kib):
+    Q = 1_000
+    _, queries = gen_data_and_queries(0, Q, 0.01)
+    disk = rtse.DiskRTree(
+        disk_index_files[page_size], page_size=page_size, cache_bytes=cache_kib << 10
+    )
+    it = cycle(queries)
+
+    for _ in range(200):
+        _ = disk.query_range(next(it))
+    disk.reset_page_stats()
+    calls = 0
+
+    def run_one():
+        nonlocal calls
+        calls += 1
+        return len(disk.query_range(next(it)))
+
+    benchmark(run_one)
+    st = benchmark.stats.stats
+    stats = disk.page_stats()
+    reads = stats.page_reads / max(calls, 1)
+    hits = stats.cache_hits / max(calls, 1)
+    benchmark.extra_info["page_reads_per_query"] = reads
+    print(
+        f"\n[disk] page={page_size} cache={cache_kib}KiB height={disk.height} "
+        f"reads/query={reads:.2f} hits/query={hits:.2f} "
+        f"mean={st.mean*1e3:.3f} ms  median={st.median*1e3:.3f} ms"
+    )
+
+@pytest.fixture(scope="module")
+def packed_points_200k():
+    rng = random.Random(314551132)
+    boxes = list(gen_uniform_points(200_000, rng))
+    return boxes, list(range(len(boxes)))
+
+
+@pytest.mark.parametrize("threads", [1, 2, 4, 8, 16])
+@pytest.mark.parametrize("win_frac", [0.01, 0.05, 0.25])
+def test_parallel_query_latency(benchmark, packed_points_200k, threads, win_frac):
+    Q = 100
+    tree = rtse.RTree(*packed_points_200k)
+    tree.enable_parallel_queries(threads)
+    rng = random.Random(314551132)
+    queries = [rand_query(win_frac, rng) for _ in range(Q)]
+    it = cycle(queries)
+
+    for _ in range(20):
+        _ = tree.query_range(next(it))
+
+    def run_one():
+        return len(tree.query_range(next(it)))
+
+    benchmark(run_one)
+    st = benchmark.stats.stats
+    print(
+        f"\n[parallel] threads={threads} win={win_frac*100:.0f}% "
+        f"mean={st.mean*1e3:.3f} ms  median={st.median*1e3:.3f} ms"
+    )
@@ -1,4 +1,10 @@
+#include "../core/disk_rtree.h"
+#include "../core/grid_index.h"
+#include "../core/packed_rtree.h"
 #include "../core/rtree.h"
+#include "../core/temporal_rtree.h"
+#include <algorithm>
+#include <pybind11/numpy.h>
 #include <pybind11/operators.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
@@ -6,6 +12,32 @@
 
 namespace py = pybind11;
 
+// hands the vector's buffer to a NumPy array without copying it
+template <typename T> static py::array_t<T> to_numpy(std::vector<T> &&vec)
+{
+    auto owner = new std::vector<T>(std::move(vec));
+    py::capsule free_when_done(
+        owner, [](void *ptr) { delete static_cast<std::vector<T> *>(ptr); });
+    return py::array_t<T>(owner->size(), owner->data(), free_when_done);
+}
+
+// ids, or (ids, distances) if with_distances, as NumPy arrays
+static py::object radius_to_python(rtse::RadiusResult &&result,
+                                   bool with_distances)
+{
+    auto ids = to_numpy(std::move(result.ids));
+    if (!with_distances)
+        return std::move(ids);
+    return py::make_tuple(ids, to_numpy(std::move(result.distances)));
+}
+
+// QueryCursor with the chunk size the Python iterator yields
+struct ChunkedCursor
+{
+    rtse::QueryCursor cursor;
+    size_t chunk_size;
+};
+
 PYBIND11_MODULE(rtse, m)
 {
     m.doc() = "R-Tree Search Engine core bindings";
@@ -42,10 +74,218 @@ PYBIND11_MODULE(rtse, m)
                         std::to_string(box.max().y()) + "))";
              });
 
+    py::class_<rtse::RangeEvent>(m, "RangeEvent",
+                                 "Enter/leave event of a standing query.")
+        .def_readonly("query_id", &rtse::RangeEvent::query_id)
+        .def_readonly("id", &rtse::RangeEvent::id)
+        .def_readonly("entered", &rtse::RangeEvent::entered)
+        .def("__repr__",
+             [](const rtse::RangeEvent &event)
+             {
+                 return "RangeEvent(query_id=" +
+                        std::to_string(event.query_id) +
+                        ", id=" + std::to_string(event.id) + ", entered=" +
+                        (event.entered ? "True" : "False") + ")";
+             });
+
+    py::class_<rtse::QueryCacheStats>(m, "QueryCacheStats",
+                                      "Counters of the query result cache.")
+        .def_readonly("hits", &rtse::QueryCacheStats::hits)
+        .def_readonly("misses", &rtse::QueryCacheStats::misses)
+        .def_readonly("invalidations", &rtse::QueryCacheStats::invalidations)
+        .def_readonly("size", &rtse::QueryCacheStats::size)
+        .def_readonly("capacity", &rtse::QueryCacheStats::capacity);
+
+    py::class_<ChunkedCursor>(
+        m, "QueryCursor",
+        "Iterator over query_range results yielding NumPy chunks of ids.")
+        .def(
+            "__iter__",
+            [](ChunkedCursor &self) -> ChunkedCursor & { return self; },
+            py::return_value_policy::reference_internal)
+        .def("__next__",
+             [](ChunkedCursor &self)
+             {
+                 std::vector<int> ids;
+                 {
+                     py::gil_scoped_release release;
+                     ids = self.cursor.next(self.chunk_size);
+                 }
+                 if (ids.empty())
+                     throw py::stop_iteration();
+                 return to_numpy(std::move(ids));
+             });
+
+    py::class_<rtse::Snapshot>(m, "Snapshot",
+                               "Immutable view sharing nodes with an RTree.")
+        .def("query_range", &rtse::Snapshot::query_range,
+             py::arg("query_box"))
+        .def("query_count", &rtse::Snapshot::query_count,
+             py::arg("query_box"))
+        .def("query_sum", &rtse::Snapshot::query_sum, py::arg("query_box"))
+        .def(
+            "query_cursor",
+            [](const rtse::Snapshot &snapshot, const rtse::Box2 &query_box,
+               size_t chunk_size)
+            {
+                return ChunkedCursor{snapshot.query_cursor(query_box),
+                                     std::max<size_t>(chunk_size, 1)};
+            },
+            py::arg("query_box"), py::arg("chunk_size") = 65536)
+        .def(
+            "query_radius",
+            [](const rtse::Snapshot &snapshot, const rtse::Point2 &center,
+               double r, bool with_distances)
+            {
+                rtse::RadiusResult result;
+                {
+                    py::gil_scoped_release release;
+                    result = snapshot.query_radius(center, r, with_distances);
+                }
+                return radius_to_python(std::move(result), with_distances);
+            },
+            py::arg("center"), py::arg("r"), py::arg("with_distances") = false)
+        .def("__len__", &rtse::Snapshot::size);
+
     py::class_<rtse::RTree>(m, "RTree")
         .def(py::init<>())
-        .def("insert", &rtse::RTree::insert, py::arg("box"), py::arg("id"))
+        .def(py::init<const std::vector<rtse::Box2> &,
+                      const std::vector<int> &, const std::vector<double> &>(),
+             py::arg("boxes"), py::arg("ids"),
+             py::arg("weights") = std::vector<double>(),
+             "Packed (STR) construction from parallel box/id lists.")
+        .def_static("from_csv", &rtse::RTree::from_csv, py::arg("path"),
+                    py::arg("threads") = 0,
+                    py::call_guard<py::gil_scoped_release>())
+        .def_static("from_wkt", &rtse::RTree::from_wkt, py::arg("path"),
+                    py::arg("threads") = 0,
+                    py::call_guard<py::gil_scoped_release>())
+        .def("insert", &rtse::RTree::insert, py::arg("box"), py::arg("id"),
+             py::arg("weight") = 1.0)
         .def("erase", &rtse::RTree::erase, py::arg("id"))
+        .def("erase_many", &rtse::RTree::erase_many, py::arg("ids"))
+        .def("erase_range", &rtse::RTree::erase_range, py::arg("query_box"))
         .def("update", &rtse::RTree::update, py::arg("id"), py::arg("new_box"))
-        .def("query_range", &rtse::RTree::query_range, py::arg("query_box"));
+        .def("query_range", &rtse::RTree::query_range, py::arg("query_box"))
+        .def("query_count", &rtse::RTree::query_count, py::arg("query_box"))
+        .def("query_sum", &rtse::RTree::query_sum, py::arg("query_box"))
+        .def(
+            "query_cursor",
+            [](const rtse::RTree &tree, const rtse::Box2 &query_box,
+               size_t chunk_size)
+            {
+                return ChunkedCursor{tree.query_cursor(query_box),
+                                     std::max<size_t>(chunk_size, 1)};
+            },
+            py::arg("query_box"), py::arg("chunk_size") = 65536,
+            "iterate the query_range ids in NumPy chunks of chunk_size")
+        .def(
+            "query_radius",
+            [](const rtse::RTree &tree, const rtse::Point2 &center, double r,
+               bool with_distances)
+            {
+                // the walk runs without the GIL, so other Python threads
+                // may mutate the tree meanwhile; the snapshot keeps the
+                // version being walked alive
+                auto snapshot = tree.snapshot();
+                rtse::RadiusResult result;
+                {
+                    py::gil_scoped_release release;
+                    result = snapshot.query_radius(center, r, with_distances);
+                }
+                return radius_to_python(std::move(result), with_distances);
+            },
+            py::arg("center"), py::arg("r"), py::arg("with_distances") = false,
+            "ids within distance r of center as a NumPy array, or an "
+            "(ids, distances) pair of parallel arrays if with_distances")
+        .def("__len__", &rtse::RTree::size)
+        .def("snapshot", &rtse::RTree::snapshot)
+        .def("subscribe", &rtse::RTree::subscribe, py::arg("query_box"))
+        .def("unsubscribe", &rtse::RTree::unsubscribe, py::arg("query_id"))
+        .def("drain_events", &rtse::RTree::drain_events)
+        .def("enable_query_cache", &rtse::RTree::enable_query_cache,
+             py::arg("capacity"))
+        .def("query_cache_stats", &rtse::RTree::query_cache_stats)
+        .def("enable_parallel_queries", &rtse::RTree::enable_parallel_queries,
+             py::arg("threads"), py::arg("task_threshold") = 4096)
+        .def("start_trace", &rtse::RTree::start_trace, py::arg("path"))
+        .def("stop_trace", &rtse::RTree::stop_trace);
+
+    py::class_<rtse::GridIndex>(
+        m, "GridIndex",
+        "Adaptive uniform grid whose dense cells switch to packed R-trees.")
+        .def(py::init<size_t>(), py::arg("cell_capacity") = 64)
+        .def(py::init<const std::vector<rtse::Box2> &,
+                      const std::vector<int> &, size_t>(),
+             py::arg("boxes"), py::arg("ids"), py::arg("cell_capacity") = 64)
+        .def("insert", &rtse::GridIndex::insert, py::arg("box"), py::arg("id"))
+        .def("erase", &rtse::GridIndex::erase, py::arg("id"))
+        .def("update", &rtse::GridIndex::update, py::arg("id"),
+             py::arg("new_box"))
+        .def("query_range", &rtse::GridIndex::query_range,
+             py::arg("query_box"))
+        .def("__len__", &rtse::GridIndex::size)
+        .def_property_readonly("columns", &rtse::GridIndex::columns)
+        .def_property_readonly("rows", &rtse::GridIndex::rows)
+        .def_property_readonly("dense_cells", &rtse::GridIndex::dense_cells)
+        .def_property_readonly("retunes", &rtse::GridIndex::retunes);
+
+    py::class_<rtse::PageStats>(m, "PageStats",
+                                "Buffer pool counters of a DiskRTree.")
+        .def_readonly("page_reads", &rtse::PageStats::page_reads)
+        .def_readonly("page_writes", &rtse::PageStats::page_writes)
+        .def_readonly("cache_hits", &rtse::PageStats::cache_hits)
+        .def_readonly("cached_pages", &rtse::PageStats::cached_pages)
+        .def_readonly("capacity", &rtse::PageStats::capacity);
+
+    py::class_<rtse::DiskRTree>(
+        m, "DiskRTree",
+        "R-tree stored as fixed-size pages of a file behind an LRU buffer "
+        "pool.")
+        .def(py::init<const std::string &, size_t, size_t>(), py::arg("path"),
+             py::arg("page_size") = 4096,
+             py::arg("cache_bytes") = size_t(64) << 20)
+        .def("insert", &rtse::DiskRTree::insert, py::arg("box"), py::arg("id"))
+        .def("erase", &rtse::DiskRTree::erase, py::arg("id"), py::arg("box"))
+        .def("query_range", &rtse::DiskRTree::query_range,
+             py::arg("query_box"))
+        .def("flush", &rtse::DiskRTree::flush)
+        .def("page_stats", &rtse::DiskRTree::page_stats)
+        .def("reset_page_stats", &rtse::DiskRTree::reset_page_stats)
+        .def("__len__", &rtse::DiskRTree::size)
+        .def_property_readonly("page_size", &rtse::DiskRTree::page_size)
+        .def_property_readonly("fanout", &rtse::DiskRTree::fanout)
+        .def_property_readonly("height", &rtse::DiskRTree::height);
+
+    py::class_<rtse::PackedRTree>(
+        m, "PackedRTree", "Immutable STR-packed R-tree in flat arrays.")
+        .def(py::init<const std::vector<rtse::Box2> &,
+                      const std::vector<int> &, size_t>(),
+             py::arg("boxes"), py::arg("ids"), py::arg("node_capacity") = 16)
+        .def("query_range",
+             py::overload_cast<const rtse::Box2 &>(
+                 &rtse::PackedRTree::query_range, py::const_),
+             py::arg("query_box"))
+        .def("__len__", &rtse::PackedRTree::size);
+
+    py::class_<rtse::TemporalRTree>(
+        m, "TemporalRTree",
+        "Sliding window of per-time-bucket R-trees with whole-bucket expiry.")
+        .def(py::init<double, size_t>(), py::arg("bucket_width"),
+             py::arg("num_buckets"))
+        .def("insert", &rtse::TemporalRTree::insert, py::arg("box"),
+             py::arg("id"), py::arg("t"))
+        .def("advance", &rtse::TemporalRTree::advance, py::arg("now"))
+        .def("query_range",
+             py::overload_cast<const rtse::Box2 &>(
+                 &rtse::TemporalRTree::query_range, py::const_),
+             py::arg("query_box"))
+        .def("query_range",
+             py::overload_cast<const rtse::Box2 &, double, double>(
+                 &rtse::TemporalRTree::query_range, py::const_),
+             py::arg("query_box"), py::arg("t0"), py::arg("t1"))
+        .def("__len__", &rtse::TemporalRTree::size)
+        .def_property_readonly("buckets", &rtse::TemporalRTree::buckets)
+        .def_property_readonly("packed_buckets",
+                               &rtse::TemporalRTree::packed_buckets);
 }
\ No newline at end of file
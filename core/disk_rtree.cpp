@@ -0,0 +1,714 @@
+#include "disk_rtree.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <limits>
+#include <list>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+static const char disk_magic[8] = {'R', 'T', 'S', 'E', 'D', 'S', 'K', '1'};
+
+// node page: uint32 leaf flag, uint32 entry count, then the entries as
+// xmin, ymin, xmax, ymax (f64) and a 64-bit reference
+static constexpr size_t node_header = 8;
+static constexpr size_t entry_size = 4 * sizeof(double) + sizeof(int64_t);
+static constexpr size_t min_frames = 8;
+
+// LRU cache of page frames over the index file; pinned frames are never
+// evicted and dirty frames are written back on eviction or flush
+class rtse::BufferPool
+{
+  public:
+    BufferPool(int fd, size_t page_size, size_t capacity)
+        : fd(fd), page_size(page_size)
+    {
+        stats.capacity = capacity;
+    }
+    ~BufferPool() { ::close(fd); }
+
+    // pins a page; a fresh page is zero-filled instead of read
+    char *pin(uint64_t page, bool fresh)
+    {
+        auto it = by_page.find(page);
+        if (it != by_page.end())
+        {
+            ++stats.cache_hits;
+            Frame &frame = frames[it->second];
+            if (frame.pins++ == 0)
+                lru.erase(frame.lru_pos);
+            if (fresh)
+            {
+                std::fill(frame.data.begin(), frame.data.end(), 0);
+                frame.dirty = true;
+            }
+            return frame.data.data();
+        }
+
+        size_t idx = take_frame();
+        Frame &frame = frames[idx];
+        if (fresh)
+            std::fill(frame.data.begin(), frame.data.end(), 0);
+        else
+        {
+            try
+            {
+                read_page(page, frame.data.data());
+            }
+            catch (...)
+            {
+                free_frames.push_back(idx); // holds no page, reuse it
+                throw;
+            }
+        }
+        frame.page = page;
+        frame.pins = 1;
+        frame.dirty = fresh;
+        by_page.emplace(page, idx);
+        return frame.data.data();
+    }
+
+    void unpin(uint64_t page, bool dirty)
+    {
+        size_t idx = by_page.at(page);
+        Frame &frame = frames[idx];
+        assert(frame.pins > 0); // page should be pinned
+        frame.dirty |= dirty;
+        if (--frame.pins == 0)
+        {
+            lru.push_front(idx);
+            frame.lru_pos = lru.begin();
+        }
+    }
+
+    void flush()
+    {
+        for (auto &frame : frames)
+            if (frame.dirty)
+            {
+                write_page(frame.page, frame.data.data());
+                frame.dirty = false;
+            }
+    }
+
+    PageStats page_stats() const
+    {
+        auto result = stats;
+        result.cached_pages = by_page.size();
+        return result;
+    }
+
+    void reset_stats()
+    {
+        size_t capacity = stats.capacity;
+        stats = PageStats();
+        stats.capacity = capacity;
+    }
+
+  private:
+    struct Frame
+    {
+        uint64_t page = 0;
+        std::vector<char> data;
+        size_t pins = 0;
+        bool dirty = false;
+        std::list<size_t>::iterator lru_pos;
+    };
+
+    // a frame left over by a failed read, a new frame while below capacity
+    // (or when everything is pinned), otherwise the least recently used
+    // unpinned one; a victim is written back before it leaves the cache
+    size_t take_frame()
+    {
+        if (!free_frames.empty())
+        {
+            size_t idx = free_frames.back();
+            free_frames.pop_back();
+            return idx;
+        }
+        if (frames.size() < stats.capacity || lru.empty())
+        {
+            frames.emplace_back();
+            frames.back().data.resize(page_size);
+            return frames.size() - 1;
+        }
+        size_t idx = lru.back();
+        Frame &victim = frames[idx];
+        if (victim.dirty)
+            write_page(victim.page, victim.data.data());
+        victim.dirty = false;
+        lru.pop_back();
+        by_page.erase(victim.page);
+        return idx;
+    }
+
+    void read_page(uint64_t page, char *data)
+    {
+        ++stats.page_reads;
+        auto n = ::pread(fd, data, page_size, page * page_size);
+        if (n != static_cast<ssize_t>(page_size))
+            throw std::runtime_error("cannot read page " +
+                                     std::to_string(page));
+    }
+
+    void write_page(uint64_t page, const char *data)
+    {
+        ++stats.page_writes;
+        auto n = ::pwrite(fd, data, page_size, page * page_size);
+        if (n != static_cast<ssize_t>(page_size))
+            throw std::runtime_error("cannot write page " +
+                                     std::to_string(page));
+    }
+
+    int fd;
+    size_t page_size;
+    std::deque<Frame> frames; // stable addresses
+    std::unordered_map<uint64_t, size_t> by_page;
+    std::list<size_t> lru; // unpinned frames, most recently used first
+    std::vector<size_t> free_frames;
+    PageStats stats;
+};
+
+namespace
+{
+
+// pinned page, unpinned when the handle goes out of scope
+class PinnedPage
+{
+  public:
+    PinnedPage(rtse::BufferPool &pool, uint64_t page, bool fresh = false)
+        : pool(pool), page(page), data(pool.pin(page, fresh)), dirty(fresh)
+    {
+    }
+    ~PinnedPage() { pool.unpin(page, dirty); }
+    PinnedPage(const PinnedPage &) = delete;
+    PinnedPage &operator=(const PinnedPage &) = delete;
+
+    rtse::BufferPool &pool;
+    uint64_t page;
+    char *data;
+    bool dirty;
+};
+
+template <typename T> T load(const char *p)
+{
+    T value;
+    std::memcpy(&value, p, sizeof(T));
+    return value;
+}
+
+template <typename T> void store(char *p, T value)
+{
+    std::memcpy(p, &value, sizeof(T));
+}
+
+// accessors of a node page
+bool is_leaf(const char *node) { return load<uint32_t>(node) != 0; }
+
+size_t entry_count(const char *node) { return load<uint32_t>(node + 4); }
+
+void set_header(char *node, bool leaf, size_t count)
+{
+    store<uint32_t>(node, leaf ? 1 : 0);
+    store<uint32_t>(node + 4, static_cast<uint32_t>(count));
+}
+
+const char *entry_at(const char *node, size_t i)
+{
+    return node + node_header + i * entry_size;
+}
+
+bool entry_overlaps(const char *node, size_t i, const rtse::Box2 &box)
+{
+    double v[4];
+    std::memcpy(v, entry_at(node, i), sizeof(v));
+    return v[2] >= box.min().x() && v[0] <= box.max().x() &&
+           v[3] >= box.min().y() && v[1] <= box.max().y();
+}
+
+rtse::Box2 entry_box(const char *node, size_t i)
+{
+    double v[4];
+    std::memcpy(v, entry_at(node, i), sizeof(v));
+    return rtse::Box2(rtse::Point2(v[0], v[1]), rtse::Point2(v[2], v[3]));
+}
+
+int64_t entry_ref(const char *node, size_t i)
+{
+    return load<int64_t>(entry_at(node, i) + 4 * sizeof(double));
+}
+
+// returns whether the stored bytes changed
+bool set_entry(char *node, size_t i, const rtse::Box2 &box, int64_t ref)
+{
+    char bytes[entry_size];
+    double v[4] = {box.min().x(), box.min().y(), box.max().x(),
+                   box.max().y()};
+    std::memcpy(bytes, v, sizeof(v));
+    std::memcpy(bytes + sizeof(v), &ref, sizeof(ref));
+    char *p = const_cast<char *>(entry_at(node, i));
+    if (std::memcmp(p, bytes, entry_size) == 0)
+        return false;
+    std::memcpy(p, bytes, entry_size);
+    return true;
+}
+
+void remove_entry(char *node, size_t i)
+{
+    size_t n = entry_count(node);
+    if (i + 1 != n)
+        std::memcpy(const_cast<char *>(entry_at(node, i)),
+                    entry_at(node, n - 1), entry_size);
+    set_header(node, is_leaf(node), n - 1);
+}
+
+rtse::Box2 node_mbr(const char *node)
+{
+    rtse::Box2 mbr;
+    for (size_t i = 0; i < entry_count(node); i++)
+        mbr = rtse::Box2::merge(mbr, entry_box(node, i));
+    return mbr;
+}
+
+} // namespace
+
+rtse::DiskRTree::DiskRTree(const std::string &path, size_t page_size,
+                           size_t cache_bytes)
+    : root(1), levels(1), count(0), page_count(2), free_head(0)
+{
+    if (page_size < 256 || page_size % 8 != 0)
+        throw std::invalid_argument(
+            "page_size should be a multiple of 8 and at least 256, got " +
+            std::to_string(page_size));
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        throw std::runtime_error("cannot open " + path);
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("cannot stat " + path);
+    }
+
+    // header page: magic, page size, root, levels, count, pages, free list
+    uint64_t header[7] = {};
+    bool existing = st.st_size > 0;
+    if (existing)
+    {
+        if (::pread(fd, header, sizeof(header), 0) != sizeof(header) ||
+            std::memcmp(header, disk_magic, sizeof(disk_magic)) != 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("not an rtse disk index: " + path);
+        }
+        page_size = header[1];
+        if (page_size < 256 || page_size % 8 != 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("corrupt page size in " + path);
+        }
+    }
+    page_bytes = page_size;
+    M = (page_size - node_header) / entry_size;
+    m = std::max<size_t>(2, M * 2 / 5);
+    pool = std::make_unique<BufferPool>(
+        fd, page_size, std::max(cache_bytes / page_size, min_frames));
+
+    if (existing)
+    {
+        root = header[2];
+        levels = header[3];
+        count = header[4];
+        page_count = header[5];
+        free_head = header[6];
+    }
+    else
+    {
+        PinnedPage node(*pool, root, true);
+        set_header(node.data, true, 0);
+        write_header();
+    }
+}
+
+rtse::DiskRTree::~DiskRTree()
+{
+    try
+    {
+        flush();
+    }
+    catch (...)
+    {
+        // nothing sensible to do with an I/O error here
+    }
+}
+
+void rtse::DiskRTree::insert(const Box2 &box, int id)
+{
+    assert(!box.is_empty()); // an empty box cannot be located again
+    insert_leaf_entry({box, id});
+    ++count;
+}
+
+bool rtse::DiskRTree::erase(int id, const Box2 &box)
+{
+    std::vector<PathStep> path;
+    uint64_t leaf;
+    size_t slot;
+    if (count == 0 || !find_entry(root, levels, box, id, path, leaf, slot))
+        return false;
+    {
+        PinnedPage node(*pool, leaf);
+        remove_entry(node.data, slot);
+        node.dirty = true;
+    }
+    --count;
+
+    // condense: under-full nodes are dissolved, the others get their
+    // parent entry refreshed
+    std::vector<Entry> orphans;
+    uint64_t page = leaf;
+    for (size_t level = 1; !path.empty(); level++)
+    {
+        auto step = path.back();
+        path.pop_back();
+        size_t n;
+        Box2 mbr;
+        {
+            PinnedPage node(*pool, page);
+            n = entry_count(node.data);
+            mbr = node_mbr(node.data);
+        }
+        PinnedPage parent(*pool, step.page);
+        if (n < m)
+        {
+            remove_entry(parent.data, step.slot);
+            parent.dirty = true;
+            dissolve(page, level, orphans);
+        }
+        else
+            parent.dirty |= set_entry(parent.data, step.slot, mbr,
+                                      entry_ref(parent.data, step.slot));
+        page = step.page;
+    }
+
+    // shrink the root while it is an internal node with a single child
+    while (levels > 1)
+    {
+        uint64_t child;
+        {
+            PinnedPage node(*pool, root);
+            size_t n = entry_count(node.data);
+            if (n == 0)
+            {
+                set_header(node.data, true, 0);
+                node.dirty = true;
+                levels = 1;
+                break;
+            }
+            if (n > 1)
+                break;
+            child = entry_ref(node.data, 0);
+        }
+        free_page(root);
+        root = child;
+        --levels;
+    }
+
+    for (auto &entry : orphans)
+        insert_leaf_entry(entry);
+    return true;
+}
+
+std::vector<int> rtse::DiskRTree::query_range(const Box2 &query_box) const
+{
+    std::vector<int> ids;
+    if (count == 0 || query_box.is_empty())
+        return ids;
+    std::vector<std::pair<uint64_t, size_t>> stack{{root, levels}};
+    while (!stack.empty())
+    {
+        auto [page, level] = stack.back();
+        stack.pop_back();
+        PinnedPage node(*pool, page);
+        for (size_t i = 0; i < entry_count(node.data); i++)
+        {
+            if (!entry_overlaps(node.data, i, query_box))
+                continue;
+            if (level == 1)
+                ids.push_back(static_cast<int>(entry_ref(node.data, i)));
+            else
+                stack.push_back({entry_ref(node.data, i), level - 1});
+        }
+    }
+    return ids;
+}
+
+size_t rtse::DiskRTree::size() const { return count; }
+
+size_t rtse::DiskRTree::page_size() const { return page_bytes; }
+
+size_t rtse::DiskRTree::fanout() const { return M; }
+
+size_t rtse::DiskRTree::height() const { return levels; }
+
+void rtse::DiskRTree::flush()
+{
+    write_header();
+    pool->flush();
+}
+
+rtse::PageStats rtse::DiskRTree::page_stats() const
+{
+    return pool->page_stats();
+}
+
+void rtse::DiskRTree::reset_page_stats() { pool->reset_stats(); }
+
+// pages on the free list keep the next free page in their first 8 bytes
+uint64_t rtse::DiskRTree::allocate_page()
+{
+    if (free_head == 0)
+        return page_count++;
+    uint64_t page = free_head;
+    PinnedPage node(*pool, page);
+    free_head = load<uint64_t>(node.data);
+    return page;
+}
+
+void rtse::DiskRTree::free_page(uint64_t page)
+{
+    PinnedPage node(*pool, page, true);
+    store<uint64_t>(node.data, free_head);
+    free_head = page;
+}
+
+void rtse::DiskRTree::write_header()
+{
+    PinnedPage header(*pool, 0, true);
+    uint64_t fields[7] = {0,     page_bytes, root,     levels,
+                          count, page_count, free_head};
+    std::memcpy(fields, disk_magic, sizeof(disk_magic));
+    std::memcpy(header.data, fields, sizeof(fields));
+}
+
+// least-enlargement descent, then splits propagate towards the root
+void rtse::DiskRTree::insert_leaf_entry(const Entry &entry)
+{
+    std::vector<PathStep> path;
+    uint64_t page = root;
+    for (size_t level = levels; level > 1; level--)
+    {
+        PinnedPage node(*pool, page);
+        size_t best = 0;
+        double best_growth = std::numeric_limits<double>::infinity();
+        double best_area = best_growth;
+        for (size_t i = 0; i < entry_count(node.data); i++)
+        {
+            auto box = entry_box(node.data, i);
+            double area = box.area();
+            double growth = Box2::merge(box, entry.box).area() - area;
+            if (growth < best_growth ||
+                (growth == best_growth && area < best_area))
+            {
+                best = i;
+                best_growth = growth;
+                best_area = area;
+            }
+        }
+        path.push_back({page, best});
+        page = entry_ref(node.data, best);
+    }
+
+    Entry carry = entry;
+    bool has_carry = true;
+    while (true)
+    {
+        Box2 mbr;
+        bool has_sibling = false;
+        Entry sibling;
+        {
+            PinnedPage node(*pool, page);
+            if (has_carry)
+            {
+                size_t n = entry_count(node.data);
+                if (n < M)
+                {
+                    set_header(node.data, is_leaf(node.data), n + 1);
+                    set_entry(node.data, n, carry.box, carry.ref);
+                }
+                else
+                {
+                    sibling = split(node.data, carry);
+                    has_sibling = true;
+                }
+                node.dirty = true;
+            }
+            mbr = node_mbr(node.data);
+        }
+
+        if (path.empty())
+        {
+            if (has_sibling)
+            {
+                uint64_t new_root = allocate_page();
+                PinnedPage node(*pool, new_root, true);
+                set_header(node.data, false, 2);
+                set_entry(node.data, 0, mbr, static_cast<int64_t>(page));
+                set_entry(node.data, 1, sibling.box, sibling.ref);
+                root = new_root;
+                ++levels;
+            }
+            return;
+        }
+        auto step = path.back();
+        path.pop_back();
+        PinnedPage parent(*pool, step.page);
+        bool changed = set_entry(parent.data, step.slot, mbr,
+                                 static_cast<int64_t>(page));
+        parent.dirty |= changed;
+        if (!changed && !has_sibling)
+            return; // nothing above changes either
+        carry = sibling;
+        has_carry = has_sibling;
+        page = step.page;
+    }
+}
+
+// splits the full node plus one extra entry in two: along the axis with the
+// smaller margin sum, at the position with the least overlap (then area);
+// the first group stays in node, the second moves to a new page
+rtse::DiskRTree::Entry rtse::DiskRTree::split(char *node, const Entry &extra)
+{
+    std::vector<Entry> entries;
+    entries.reserve(M + 1);
+    for (size_t i = 0; i < entry_count(node); i++)
+        entries.push_back({entry_box(node, i), entry_ref(node, i)});
+    entries.push_back(extra);
+    size_t n = entries.size();
+
+    auto sort_axis = [&](int axis)
+    {
+        std::sort(entries.begin(), entries.end(),
+                  [axis](const Entry &a, const Entry &b)
+                  {
+                      return axis == 0 ? a.box.min().x() + a.box.max().x() <
+                                             b.box.min().x() + b.box.max().x()
+                                       : a.box.min().y() + a.box.max().y() <
+                                             b.box.min().y() + b.box.max().y();
+                  });
+    };
+    // prefix and suffix MBRs of the current order
+    std::vector<Box2> front(n), back(n);
+    auto sweep = [&]()
+    {
+        Box2 acc;
+        for (size_t i = 0; i < n; i++)
+            front[i] = acc = Box2::merge(acc, entries[i].box);
+        acc = Box2();
+        for (size_t i = n; i-- > 0;)
+            back[i] = acc = Box2::merge(acc, entries[i].box);
+    };
+    auto margin = [](const Box2 &b)
+    { return b.max().x() - b.min().x() + b.max().y() - b.min().y(); };
+
+    double margins[2];
+    for (int axis = 0; axis < 2; axis++)
+    {
+        sort_axis(axis);
+        sweep();
+        margins[axis] = 0;
+        for (size_t k = m; k <= n - m; k++)
+            margins[axis] += margin(front[k - 1]) + margin(back[k]);
+    }
+    if (margins[0] <= margins[1])
+    {
+        sort_axis(0);
+        sweep();
+    } // otherwise the y order is still in place
+
+    size_t best = m;
+    double best_overlap = std::numeric_limits<double>::infinity();
+    double best_area = best_overlap;
+    for (size_t k = m; k <= n - m; k++)
+    {
+        const Box2 &a = front[k - 1], &b = back[k];
+        double w = std::min(a.max().x(), b.max().x()) -
+                   std::max(a.min().x(), b.min().x());
+        double h = std::min(a.max().y(), b.max().y()) -
+                   std::max(a.min().y(), b.min().y());
+        double overlap = w > 0 && h > 0 ? w * h : 0;
+        double area = a.area() + b.area();
+        if (overlap < best_overlap ||
+            (overlap == best_overlap && area < best_area))
+        {
+            best = k;
+            best_overlap = overlap;
+            best_area = area;
+        }
+    }
+
+    bool leaf = is_leaf(node);
+    set_header(node, leaf, best);
+    for (size_t i = 0; i < best; i++)
+        set_entry(node, i, entries[i].box, entries[i].ref);
+
+    uint64_t page = allocate_page();
+    PinnedPage other(*pool, page, true);
+    set_header(other.data, leaf, n - best);
+    for (size_t i = best; i < n; i++)
+        set_entry(other.data, i - best, entries[i].box, entries[i].ref);
+    return {back[best], static_cast<int64_t>(page)};
+}
+
+bool rtse::DiskRTree::find_entry(uint64_t page, size_t level, const Box2 &box,
+                                 int id, std::vector<PathStep> &path,
+                                 uint64_t &leaf, size_t &slot) const
+{
+    PinnedPage node(*pool, page);
+    for (size_t i = 0; i < entry_count(node.data); i++)
+    {
+        if (level == 1)
+        {
+            if (entry_ref(node.data, i) == id && entry_box(node.data, i) == box)
+            {
+                leaf = page;
+                slot = i;
+                return true;
+            }
+            continue;
+        }
+        if (!entry_box(node.data, i).contains(box))
+            continue;
+        path.push_back({page, i});
+        if (find_entry(entry_ref(node.data, i), level - 1, box, id, path, leaf,
+                       slot))
+            return true;
+        path.pop_back();
+    }
+    return false;
+}
+
+// frees a detached subtree and collects its leaf entries for reinsertion
+void rtse::DiskRTree::dissolve(uint64_t page, size_t level,
+                               std::vector<Entry> &orphans)
+{
+    std::vector<uint64_t> children;
+    {
+        PinnedPage node(*pool, page);
+        for (size_t i = 0; i < entry_count(node.data); i++)
+        {
+            if (level == 1)
+                orphans.push_back(
+                    {entry_box(node.data, i), entry_ref(node.data, i)});
+            else
+                children.push_back(entry_ref(node.data, i));
+        }
+    }
+    for (auto child : children)
+        dissolve(child, level - 1, orphans);
+    free_page(page);
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include "rtree.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace rtse
+{
+
+class BufferPool;
+
+// counters of the DiskRTree buffer pool; page_reads are the pages that had
+// to be read from the file, cache_hits the accesses served from memory
+struct PageStats
+{
+    size_t page_reads = 0;
+    size_t page_writes = 0;
+    size_t cache_hits = 0;
+    size_t cached_pages = 0;
+    size_t capacity = 0;
+};
+
+// Disk-resident R-tree. Every node is one fixed-size page of a file, and
+// pages are cached by an LRU buffer pool of at most cache_bytes (at least
+// 8 pages; the pages pinned along one root-to-leaf path may briefly exceed
+// it). An entry is four doubles plus a 64-bit child page or id, so the
+// fan-out follows from the page size: 102 for 4 KiB, 409 for 16 KiB.
+// page_size must be a multiple of 8 and at least 256 (std::invalid_argument
+// otherwise); an existing file is reopened with the page size it was
+// created with.
+// Not thread-safe: queries go through the buffer pool as well.
+class DiskRTree
+{
+  public:
+    explicit DiskRTree(const std::string &path, size_t page_size = 4096,
+                       size_t cache_bytes = size_t(64) << 20);
+    ~DiskRTree();
+    DiskRTree(const DiskRTree &) = delete;
+    DiskRTree &operator=(const DiskRTree &) = delete;
+    void insert(const Box2 &box, int id);
+    // there is no in-memory id map, so the entry is located by its box;
+    // returns false if no entry (box, id) exists
+    bool erase(int id, const Box2 &box);
+    std::vector<int> query_range(const Box2 &query_box) const;
+    size_t size() const;
+    size_t page_size() const;
+    size_t fanout() const;
+    size_t height() const;
+    // writes the dirty pages and the file header
+    void flush();
+    PageStats page_stats() const;
+    void reset_page_stats();
+
+  private:
+    struct Entry
+    {
+        Box2 box;
+        int64_t ref; // child page, or id in a leaf
+    };
+    struct PathStep
+    {
+        uint64_t page;
+        size_t slot; // entry of the child taken in this node
+    };
+    std::unique_ptr<BufferPool> pool;
+    size_t page_bytes;
+    size_t M, m;
+    uint64_t root;
+    size_t levels; // 1 while the root is a leaf
+    size_t count;
+    uint64_t page_count, free_head;
+    // private function for page management
+    uint64_t allocate_page();
+    void free_page(uint64_t page);
+    void write_header();
+    // private function for insert()
+    void insert_leaf_entry(const Entry &entry);
+    Entry split(char *node, const Entry &extra);
+    // private function for erase()
+    bool find_entry(uint64_t page, size_t level, const Box2 &box, int id,
+                    std::vector<PathStep> &path, uint64_t &leaf,
+                    size_t &slot) const;
+    void dissolve(uint64_t page, size_t level, std::vector<Entry> &orphans);
+};
+
+}; // namespace rtse
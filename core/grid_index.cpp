@@ -0,0 +1,232 @@
+#include "grid_index.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+// upper bound of cells per axis keeps the directory small
+static constexpr size_t max_cells_per_axis = 1024;
+
+rtse::GridIndex::GridIndex(size_t cell_capacity)
+    : cell_capacity(std::max<size_t>(cell_capacity, 1)), extent(),
+      cell_w(0), cell_h(0), nx(1), ny(1), cells(1), num_dense(0),
+      tuned_size(0), num_retunes(0)
+{
+}
+
+rtse::GridIndex::GridIndex(const std::vector<Box2> &boxes,
+                           const std::vector<int> &ids, size_t cell_capacity)
+    : GridIndex(cell_capacity)
+{
+    assert(boxes.size() == ids.size()); // buffers should be parallel
+    id_to_box.reserve(ids.size());
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+        assert(id_to_box.find(ids[i]) == id_to_box.end()); // id should be unique
+        id_to_box.emplace(ids[i], boxes[i]);
+    }
+    retune();
+}
+
+void rtse::GridIndex::insert(const Box2 &box, int id)
+{
+    assert(id_to_box.find(id) == id_to_box.end()); // id should be unique
+    id_to_box[id] = box;
+    for (size_t r = row(box.min().y()); r <= row(box.max().y()); r++)
+        for (size_t c = column(box.min().x()); c <= column(box.max().x()); c++)
+            add_to_cell(cells[r * nx + c], box, id);
+    maybe_retune();
+}
+
+void rtse::GridIndex::erase(int id)
+{
+    assert(id_to_box.find(id) != id_to_box.end()); // erased id should exist
+    auto box = id_to_box[id];
+    for (size_t r = row(box.min().y()); r <= row(box.max().y()); r++)
+        for (size_t c = column(box.min().x()); c <= column(box.max().x()); c++)
+            remove_from_cell(cells[r * nx + c], id);
+    id_to_box.erase(id);
+    maybe_retune();
+}
+
+void rtse::GridIndex::update(int id, const Box2 &new_box)
+{
+    assert(id_to_box.find(id) != id_to_box.end()); // updated id should exist
+    erase(id);
+    insert(new_box, id);
+}
+
+std::vector<int> rtse::GridIndex::query_range(const Box2 &query_box) const
+{
+    std::vector<int> ids;
+    if (query_box.is_empty() || id_to_box.empty())
+        return ids;
+
+    size_t c0 = column(query_box.min().x()), c1 = column(query_box.max().x());
+    size_t r0 = row(query_box.min().y()), r1 = row(query_box.max().y());
+    // inside a single cell every hit is owned by that cell
+    bool single = c0 == c1 && r0 == r1;
+    for (size_t r = r0; r <= r1; r++)
+    {
+        for (size_t c = c0; c <= c1; c++)
+        {
+            // a replicated box is reported only by the cell holding the
+            // lower-left corner of its intersection with the query
+            auto owned = [&](const Box2 &box)
+            {
+                return column(std::max(query_box.min().x(), box.min().x())) ==
+                           c &&
+                       row(std::max(query_box.min().y(), box.min().y())) == r;
+            };
+            const Cell &cell = cells[r * nx + c];
+            if (cell.tree)
+            {
+                for (auto id : cell.tree->query_range(query_box))
+                    if (single || owned(id_to_box.at(id)))
+                        ids.push_back(id);
+            }
+            else
+            {
+                for (size_t i = 0; i < cell.ids.size(); i++)
+                    if (query_box.overlap(cell.boxes[i]) &&
+                        (single || owned(cell.boxes[i])))
+                        ids.push_back(cell.ids[i]);
+            }
+        }
+    }
+    return ids;
+}
+
+size_t rtse::GridIndex::size() const { return id_to_box.size(); }
+
+size_t rtse::GridIndex::columns() const { return nx; }
+
+size_t rtse::GridIndex::rows() const { return ny; }
+
+size_t rtse::GridIndex::dense_cells() const { return num_dense; }
+
+size_t rtse::GridIndex::retunes() const { return num_retunes; }
+
+// coordinates outside the tuned extent fall into the border cells
+size_t rtse::GridIndex::column(double x) const
+{
+    if (nx == 1)
+        return 0;
+    double c = std::floor((x - extent.min().x()) / cell_w);
+    return static_cast<size_t>(std::clamp(c, 0.0, double(nx - 1)));
+}
+
+size_t rtse::GridIndex::row(double y) const
+{
+    if (ny == 1)
+        return 0;
+    double r = std::floor((y - extent.min().y()) / cell_h);
+    return static_cast<size_t>(std::clamp(r, 0.0, double(ny - 1)));
+}
+
+void rtse::GridIndex::add_to_cell(Cell &cell, const Box2 &box, int id)
+{
+    if (cell.tree)
+    {
+        cell.tree->insert(box, id);
+        return;
+    }
+    cell.boxes.push_back(box);
+    cell.ids.push_back(id);
+    if (cell.ids.size() > cell_capacity)
+        densify(cell);
+}
+
+// dense cell: switch from the flat lists to a packed tree
+void rtse::GridIndex::densify(Cell &cell)
+{
+    cell.tree = std::make_unique<RTree>(cell.boxes, cell.ids);
+    cell.boxes = std::vector<Box2>();
+    cell.ids = std::vector<int>();
+    ++num_dense;
+}
+
+void rtse::GridIndex::remove_from_cell(Cell &cell, int id)
+{
+    if (cell.tree)
+    {
+        cell.tree->erase(id);
+        return;
+    }
+    auto it = std::find(cell.ids.begin(), cell.ids.end(), id);
+    assert(it != cell.ids.end()); // id should be stored in every overlapped cell
+    size_t idx = it - cell.ids.begin();
+    std::swap(cell.ids[idx], cell.ids.back());
+    std::swap(cell.boxes[idx], cell.boxes.back());
+    cell.ids.pop_back();
+    cell.boxes.pop_back();
+}
+
+// re-tune when the entry count doubled or halved since the last tune, or
+// when a quarter of the cells turned dense after the count grew by a quarter
+void rtse::GridIndex::maybe_retune()
+{
+    size_t n = id_to_box.size(), base = std::max(tuned_size, cell_capacity);
+    bool grew = n >= 2 * base;
+    bool shrank = tuned_size > cell_capacity && 2 * n < tuned_size;
+    bool dense = num_dense * 4 > cells.size() && 4 * n >= 5 * base;
+    if (grew || shrank || dense)
+        retune();
+}
+
+// choose the resolution from the current data and rebuild every cell
+void rtse::GridIndex::retune()
+{
+    ++num_retunes;
+    tuned_size = id_to_box.size();
+
+    extent = Box2();
+    double sum_w = 0, sum_h = 0;
+    for (auto &[id, box] : id_to_box)
+    {
+        extent = Box2::merge(extent, box);
+        sum_w += box.max().x() - box.min().x();
+        sum_h += box.max().y() - box.min().y();
+    }
+
+    nx = ny = 1;
+    if (tuned_size > 0)
+    {
+        double n = static_cast<double>(tuned_size);
+        double width = extent.max().x() - extent.min().x();
+        double height = extent.max().y() - extent.min().y();
+        // about half a cell's capacity per cell for uniformly spread data
+        double target_cells = std::max(1.0, 2.0 * n / cell_capacity);
+        double side = width * height > 0
+                          ? std::sqrt(width * height / target_cells)
+                          : std::max(width, height) / target_cells;
+        // keep cells at least twice the mean box size, so that a box is
+        // replicated into 1.5 cells per axis on average
+        double cw = std::max(side, 2 * sum_w / n);
+        double ch = std::max(side, 2 * sum_h / n);
+        auto cells_along = [](double length, double cell)
+        {
+            if (!(length > 0) || !(cell > 0))
+                return size_t(1);
+            return static_cast<size_t>(std::clamp(
+                std::floor(length / cell), 1.0, double(max_cells_per_axis)));
+        };
+        nx = cells_along(width, cw);
+        ny = cells_along(height, ch);
+        cell_w = width / nx;
+        cell_h = height / ny;
+    }
+
+    cells = std::vector<Cell>(nx * ny);
+    num_dense = 0;
+    for (auto &[id, box] : id_to_box)
+        for (size_t r = row(box.min().y()); r <= row(box.max().y()); r++)
+            for (size_t c = column(box.min().x()); c <= column(box.max().x());
+                 c++)
+            {
+                cells[r * nx + c].boxes.push_back(box);
+                cells[r * nx + c].ids.push_back(id);
+            }
+    for (auto &cell : cells)
+        if (cell.ids.size() > cell_capacity)
+            densify(cell);
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "rtree.h"
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace rtse
+{
+
+// Uniform grid above per-cell indexes. A box is stored in every cell it
+// overlaps; a cell keeps plain box/id lists while it holds at most
+// cell_capacity entries and switches to its own packed RTree once it gets
+// denser. The resolution is derived from the data extent, the entry count
+// and the mean box size, and re-tuned when either changes substantially.
+class GridIndex
+{
+  public:
+    explicit GridIndex(size_t cell_capacity = 64);
+    GridIndex(const std::vector<Box2> &boxes, const std::vector<int> &ids,
+              size_t cell_capacity = 64);
+    void insert(const Box2 &box, int id);
+    void erase(int id);
+    void update(int id, const Box2 &new_box);
+    std::vector<int> query_range(const Box2 &query_box) const;
+    size_t size() const;
+    size_t columns() const;
+    size_t rows() const;
+    size_t dense_cells() const;
+    size_t retunes() const;
+
+  private:
+    struct Cell
+    {
+        std::vector<Box2> boxes;
+        std::vector<int> ids;
+        std::unique_ptr<RTree> tree; // set once the cell became dense
+    };
+    size_t cell_capacity;
+    Box2 extent;
+    double cell_w, cell_h;
+    size_t nx, ny;
+    std::vector<Cell> cells;
+    size_t num_dense;
+    size_t tuned_size, num_retunes;
+    std::unordered_map<int, Box2> id_to_box;
+    // private function for cell addressing
+    size_t column(double x) const;
+    size_t row(double y) const;
+    // private function for insert() and erase()
+    void add_to_cell(Cell &cell, const Box2 &box, int id);
+    void remove_from_cell(Cell &cell, int id);
+    void densify(Cell &cell);
+    void maybe_retune();
+    void retune();
+};
+
+}; // namespace rtse
@@ -0,0 +1,347 @@
+#include "io.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_set>
+
+size_t rtse::EntryBuffer::size() const { return ids.size(); }
+
+void rtse::EntryBuffer::reserve(size_t n)
+{
+    boxes.reserve(n);
+    ids.reserve(n);
+}
+
+void rtse::EntryBuffer::push_back(const Box2 &box, int id)
+{
+    boxes.push_back(box);
+    ids.push_back(id);
+}
+
+namespace
+{
+
+// read-only mapping of a whole file, unmapped on destruction
+class MappedFile
+{
+  public:
+    explicit MappedFile(const std::string &path)
+    {
+        m_fd = ::open(path.c_str(), O_RDONLY);
+        if (m_fd < 0)
+            throw std::runtime_error("cannot open " + path);
+        struct stat st;
+        if (::fstat(m_fd, &st) != 0)
+        {
+            ::close(m_fd);
+            throw std::runtime_error("cannot stat " + path);
+        }
+        m_size = static_cast<size_t>(st.st_size);
+        if (m_size == 0)
+            return;
+        void *addr = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+        if (addr == MAP_FAILED)
+        {
+            ::close(m_fd);
+            throw std::runtime_error("cannot map " + path);
+        }
+        ::madvise(addr, m_size, MADV_SEQUENTIAL);
+        m_data = static_cast<const char *>(addr);
+    }
+    ~MappedFile()
+    {
+        if (m_data)
+            ::munmap(const_cast<char *>(m_data), m_size);
+        ::close(m_fd);
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+  private:
+    int m_fd = -1;
+    const char *m_data = nullptr;
+    size_t m_size = 0;
+};
+
+} // namespace
+
+static bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+static const char *skip_blank(const char *p, const char *end)
+{
+    while (p != end && is_blank(*p))
+        ++p;
+    return p;
+}
+
+// returns the position after the number, or nullptr if none was parsed
+static const char *parse_double(const char *p, const char *end, double &value)
+{
+    if (p != end && *p == '+')
+        ++p;
+    auto [ptr, ec] = std::from_chars(p, end, value);
+    return ec == std::errc() ? ptr : nullptr;
+}
+
+static const char *parse_id(const char *p, const char *end, int &id)
+{
+    p = skip_blank(p, end);
+    auto [ptr, ec] = std::from_chars(p, end, id);
+    return ec == std::errc() ? ptr : nullptr;
+}
+
+static bool ends_with(std::string_view token, std::string_view suffix)
+{
+    if (token.size() < suffix.size())
+        return false;
+    for (size_t i = 0; i < suffix.size(); i++)
+        if (std::toupper(static_cast<unsigned char>(
+                token[token.size() - suffix.size() + i])) != suffix[i])
+            return false;
+    return true;
+}
+
+// "id,xmin,ymin,xmax,ymax" or "id,x,y"
+static bool parse_csv_row(const char *p, const char *end, rtse::EntryBuffer &out)
+{
+    int id;
+    if (!(p = parse_id(p, end, id)))
+        return false;
+
+    double v[4];
+    size_t n = 0;
+    while ((p = skip_blank(p, end)) != end)
+    {
+        if (*p != ',' || n == 4)
+            return false;
+        if (!(p = parse_double(skip_blank(p + 1, end), end, v[n++])))
+            return false;
+    }
+    if (n == 2)
+        out.push_back(rtse::Box2::from_point(rtse::Point2(v[0], v[1])), id);
+    else if (n == 4)
+        out.push_back(
+            rtse::Box2(rtse::Point2(v[0], v[1]), rtse::Point2(v[2], v[3])), id);
+    else
+        return false;
+    return true;
+}
+
+// "id,<WKT>": the MBR of all coordinates, whatever the geometry type
+static bool parse_wkt_row(const char *p, const char *end, rtse::EntryBuffer &out)
+{
+    int id;
+    if (!(p = parse_id(p, end, id)))
+        return false;
+    if (p == end || (*p != ',' && *p != ';' && *p != '\t'))
+        return false;
+    ++p;
+
+    // geometry tag with an optional dimension, e.g. "POINT Z" or "POINTZM"
+    size_t dim = 2, tokens = 0;
+    while (true)
+    {
+        while (p != end && (is_blank(*p) || *p == '"'))
+            ++p;
+        const char *begin = p;
+        while (p != end && std::isalpha(static_cast<unsigned char>(*p)))
+            ++p;
+        if (p == begin)
+            break;
+        std::string_view token(begin, p - begin);
+        ++tokens;
+        if (ends_with(token, "ZM"))
+            dim = 4;
+        else if (ends_with(token, "Z") || ends_with(token, "M"))
+            dim = 3;
+    }
+    if (tokens == 0)
+        return false;
+
+    // the first two ordinates of every coordinate tuple are x and y
+    constexpr double inf = std::numeric_limits<double>::infinity();
+    double min_x = inf, min_y = inf, max_x = -inf, max_y = -inf;
+    size_t k = 0, total = 0;
+    while (p != end)
+    {
+        char c = *p;
+        if (c == '(' || c == ')' || c == ',' || c == '"' || is_blank(c) ||
+            std::isalpha(static_cast<unsigned char>(c)))
+        {
+            ++p; // structure and nested tags (collections, EMPTY members)
+            continue;
+        }
+        double v;
+        if (!(p = parse_double(p, end, v)))
+            return false;
+        if (k == 0)
+        {
+            min_x = std::min(min_x, v);
+            max_x = std::max(max_x, v);
+        }
+        else if (k == 1)
+        {
+            min_y = std::min(min_y, v);
+            max_y = std::max(max_y, v);
+        }
+        k = (k + 1) % dim;
+        ++total;
+    }
+    if (k != 0)
+        return false;
+    if (total > 0) // EMPTY geometries have nothing to index
+        out.push_back(
+            rtse::Box2(rtse::Point2(min_x, min_y), rtse::Point2(max_x, max_y)),
+            id);
+    return true;
+}
+
+// split the mapped file into row-aligned chunks parsed on worker threads
+template <typename RowParser>
+static rtse::EntryBuffer parse_file(const std::string &path, unsigned threads,
+                                    const char *kind, RowParser parse_row)
+{
+    MappedFile file(path);
+    const char *base = file.data(), *end = base + file.size();
+
+    // keep chunks large enough to amortize thread start-up
+    constexpr size_t min_chunk = 1 << 20;
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned>(
+        std::min<size_t>(threads, file.size() / min_chunk + 1));
+
+    std::vector<const char *> bounds(threads + 1, end);
+    bounds[0] = base;
+    for (unsigned t = 1; t < threads; t++)
+    {
+        const char *p =
+            std::max(base + file.size() * t / threads, bounds[t - 1]);
+        auto nl = static_cast<const char *>(std::memchr(p, '\n', end - p));
+        bounds[t] = nl ? nl + 1 : end;
+    }
+
+    std::vector<rtse::EntryBuffer> parts(threads);
+    std::vector<std::exception_ptr> errors(threads);
+    auto worker = [&](unsigned t)
+    {
+        try
+        {
+            const char *p = bounds[t], *stop = bounds[t + 1];
+            parts[t].reserve((stop - p) / 32);
+            while (p < stop)
+            {
+                auto nl = static_cast<const char *>(
+                    std::memchr(p, '\n', stop - p));
+                const char *eol = nl ? nl : stop;
+                const char *first = skip_blank(p, eol);
+                // a non-numeric first row of the file is a header
+                bool header = p == base && first != eol &&
+                              !std::isdigit(static_cast<unsigned char>(*first)) &&
+                              *first != '-' && *first != '+';
+                if (first != eol && !header && !parse_row(p, eol, parts[t]))
+                    throw std::runtime_error(
+                        std::string("malformed ") + kind + " row at byte " +
+                        std::to_string(p - base) + " of " + path);
+                p = eol + 1;
+            }
+        }
+        catch (...)
+        {
+            errors[t] = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; t++)
+        pool.emplace_back(worker, t);
+    worker(0);
+    for (auto &th : pool)
+        th.join();
+    for (auto &error : errors)
+        if (error)
+            std::rethrow_exception(error);
+
+    auto result = std::move(parts[0]);
+    size_t total = 0;
+    for (auto &part : parts)
+        total += part.size();
+    result.reserve(total);
+    for (unsigned t = 1; t < threads; t++)
+    {
+        result.boxes.insert(result.boxes.end(), parts[t].boxes.begin(),
+                            parts[t].boxes.end());
+        result.ids.insert(result.ids.end(), parts[t].ids.begin(),
+                          parts[t].ids.end());
+    }
+    return result;
+}
+
+// the indexes map ids to entries, so a repeated id would corrupt them
+static void check_ids(const rtse::EntryBuffer &buffer, const std::string &path,
+                      const char *kind)
+{
+    std::unordered_set<int> seen;
+    seen.reserve(buffer.size());
+    for (auto id : buffer.ids)
+        if (!seen.insert(id).second)
+            throw std::runtime_error(std::string("duplicate ") + kind +
+                                     " id " + std::to_string(id) + " in " +
+                                     path);
+}
+
+// the packed constructor already hashes every id into id_to_box and rejects
+// repeats, so the tree is built straight from the parsed buffer instead of
+// hashing the ids once more in check_ids()
+static rtse::RTree build_tree(const rtse::EntryBuffer &buffer,
+                              const std::string &path, const char *kind)
+{
+    try
+    {
+        return rtse::RTree(buffer.boxes, buffer.ids);
+    }
+    catch (const std::invalid_argument &error) // only duplicates can fail
+    {
+        throw std::runtime_error(kind + std::string(" file ") + path + ": " +
+                                 error.what());
+    }
+}
+
+rtse::EntryBuffer rtse::read_csv(const std::string &path, unsigned threads)
+{
+    auto buffer = parse_file(path, threads, "CSV", parse_csv_row);
+    check_ids(buffer, path, "CSV");
+    return buffer;
+}
+
+rtse::EntryBuffer rtse::read_wkt(const std::string &path, unsigned threads)
+{
+    auto buffer = parse_file(path, threads, "WKT", parse_wkt_row);
+    check_ids(buffer, path, "WKT");
+    return buffer;
+}
+
+rtse::RTree rtse::RTree::from_csv(const std::string &path, unsigned threads)
+{
+    return build_tree(parse_file(path, threads, "CSV", parse_csv_row), path,
+                      "CSV");
+}
+
+rtse::RTree rtse::RTree::from_wkt(const std::string &path, unsigned threads)
+{
+    return build_tree(parse_file(path, threads, "WKT", parse_wkt_row), path,
+                      "WKT");
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "rtree.h"
+#include <string>
+#include <vector>
+
+namespace rtse
+{
+
+// flat, parallel box/id buffers filled by the ingest layer
+struct EntryBuffer
+{
+    std::vector<Box2> boxes;
+    std::vector<int> ids;
+    size_t size() const;
+    void reserve(size_t n);
+    void push_back(const Box2 &box, int id);
+};
+
+// CSV rows: "id,xmin,ymin,xmax,ymax" or "id,x,y"; an optional header row is
+// skipped. threads == 0 uses all hardware threads. Malformed rows and
+// repeated ids throw std::runtime_error.
+EntryBuffer read_csv(const std::string &path, unsigned threads = 0);
+// WKT rows: "id,<WKT geometry>" ("," ";" or tab separated); the MBR of every
+// coordinate in the geometry is indexed and EMPTY geometries are skipped.
+EntryBuffer read_wkt(const std::string &path, unsigned threads = 0);
+
+}; // namespace rtse
@@ -0,0 +1,103 @@
+#include "packed_rtree.h"
+#include <cassert>
+
+rtse::PackedRTree::PackedRTree() : num_entries(0) {}
+
+rtse::PackedRTree::PackedRTree(const std::vector<Box2> &boxes,
+                               const std::vector<int> &ids,
+                               size_t node_capacity)
+    : num_entries(ids.size())
+{
+    assert(boxes.size() == ids.size()); // buffers should be parallel
+    assert(node_capacity >= 2);
+    if (boxes.empty())
+        return;
+
+    // entry level in STR order
+    auto order = str_order(boxes, node_capacity);
+    this->boxes.reserve(num_entries + num_entries / (node_capacity - 1) + 1);
+    this->ids.reserve(num_entries);
+    for (auto i : order)
+    {
+        this->boxes.push_back(boxes[i]);
+        this->ids.push_back(ids[i]);
+    }
+
+    // upper levels: group consecutive runs of the level below, which is
+    // re-sorted by STR first (its nodes keep their child runs)
+    size_t begin = 0, end = num_entries;
+    do
+    {
+        size_t n = end - begin;
+        if (begin > 0)
+        {
+            std::vector<Box2> level(this->boxes.begin() + begin,
+                                    this->boxes.begin() + end);
+            auto level_order = str_order(level, node_capacity);
+            size_t first = begin - num_entries;
+            std::vector<size_t> cb(child_begin.begin() + first,
+                                   child_begin.begin() + first + n);
+            std::vector<size_t> ce(child_end.begin() + first,
+                                   child_end.begin() + first + n);
+            for (size_t i = 0; i < n; i++)
+            {
+                this->boxes[begin + i] = level[level_order[i]];
+                child_begin[first + i] = cb[level_order[i]];
+                child_end[first + i] = ce[level_order[i]];
+            }
+        }
+        auto bounds = str_groups(n, node_capacity);
+        for (size_t g = 0; g + 1 < bounds.size(); g++)
+        {
+            size_t lo = begin + bounds[g], hi = begin + bounds[g + 1];
+            Box2 mbr;
+            for (size_t i = lo; i < hi; i++)
+                mbr = Box2::merge(mbr, this->boxes[i]);
+            this->boxes.push_back(mbr);
+            child_begin.push_back(lo);
+            child_end.push_back(hi);
+        }
+        begin = end;
+        end = this->boxes.size();
+    } while (end - begin > 1);
+}
+
+size_t rtse::PackedRTree::size() const { return num_entries; }
+
+rtse::Box2 rtse::PackedRTree::bounds() const
+{
+    return boxes.empty() ? Box2() : boxes.back();
+}
+
+std::vector<int> rtse::PackedRTree::query_range(const Box2 &query_box) const
+{
+    std::vector<int> ids;
+    query_range(query_box, ids);
+    return ids;
+}
+
+void rtse::PackedRTree::query_range(const Box2 &query_box,
+                                    std::vector<int> &ids) const
+{
+    if (boxes.empty() || !query_box.overlap(boxes.back()))
+        return;
+    // explicit stack of upper-level nodes whose MBR overlaps the query
+    std::vector<size_t> stack{boxes.size() - 1};
+    while (!stack.empty())
+    {
+        size_t k = stack.back() - num_entries;
+        stack.pop_back();
+        if (child_begin[k] < num_entries) // children are entries
+        {
+            for (size_t c = child_begin[k]; c < child_end[k]; c++)
+                if (query_box.overlap(boxes[c]))
+                    ids.push_back(this->ids[c]);
+        }
+        else
+        {
+            for (size_t c = child_begin[k]; c < child_end[k]; c++)
+                if (query_box.overlap(boxes[c]))
+                    stack.push_back(c);
+        }
+    }
+}
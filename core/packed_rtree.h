@@ -0,0 +1,33 @@
+#pragma once
+#include "rtree.h"
+#include <vector>
+
+namespace rtse
+{
+
+// Immutable STR-packed R-tree in flat arrays: every level is stored
+// contiguously, entries first and the root last, and each upper-level node
+// refers to a run of the level below. No per-node allocation, so building
+// and dropping one costs a handful of allocations whatever its size.
+class PackedRTree
+{
+  public:
+    PackedRTree();
+    PackedRTree(const std::vector<Box2> &boxes, const std::vector<int> &ids,
+                size_t node_capacity = 16);
+    size_t size() const;
+    Box2 bounds() const;
+    std::vector<int> query_range(const Box2 &query_box) const;
+    // appends the hits to ids, for callers merging several trees
+    void query_range(const Box2 &query_box, std::vector<int> &ids) const;
+
+  private:
+    size_t num_entries;
+    std::vector<Box2> boxes; // all levels, entries first, root last
+    std::vector<int> ids;    // parallel to the entry level
+    // children of upper-level node k are the boxes in
+    // [child_begin[k - num_entries], child_end[k - num_entries])
+    std::vector<size_t> child_begin, child_end;
+};
+
+}; // namespace rtse
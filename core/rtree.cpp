@@ -1,91 +1,75 @@
 #include "rtree.h"
+#include "trace.h"
 #include <algorithm>
 #include <cassert>
 #include <iostream>
+#include <iterator>
 #include <limits>
+#include <list>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
 #include <vector>
 
-double rtse::Point2::x() const { return m_x; }
-
-double rtse::Point2::y() const { return m_y; }
-
-rtse::Box2::Box2() : m_is_empty(true) {}
-
-rtse::Box2::Box2(const rtse::Point2 &p1, const rtse::Point2 &p2)
-    : m_is_empty(false),
-      m_min(Point2(std::min(p1.x(), p2.x()), std::min(p1.y(), p2.y()))),
-      m_max(Point2(std::max(p1.x(), p2.x()), std::max(p1.y(), p2.y())))
-{
-}
-
-const rtse::Point2 &rtse::Box2::min() const { return m_min; }
-
-const rtse::Point2 &rtse::Box2::max() const { return m_max; }
-
-bool rtse::Box2::is_empty() const { return m_is_empty; }
-
-rtse::Box2 rtse::Box2::from_point(const rtse::Point2 &p) { return Box2(p, p); }
-
-double rtse::Box2::area() const
-{
-    if (is_empty())
-        return 0;
-    return std::max(0.0, (max().x() - min().x()) * (max().y() - min().y()));
-}
-
-bool rtse::Box2::overlap(const rtse::Box2 &other) const
+std::pair<const rtse::Box2 &, int> rtse::Node::entry(size_t i) const
 {
-    if (this->is_empty())
-        return false;
-    if (other.is_empty())
-        return false;
-    return (max().x() >= other.min().x() &&
-            min().x() <= other.max().x()) // x-axis intersects
-           && (max().y() >= other.min().y() &&
-               min().y() <= other.max().y()); // y-axis intersects
+    return {boxes[i], ids[i]};
 }
 
-rtse::Box2 rtse::Box2::merge(const Box2 &box1, const Box2 &box2)
+rtse::Node *rtse::Node::clone() const
 {
-    if (box1.is_empty())
-        return box2;
-    if (box2.is_empty())
-        return box1;
-    return Box2(Point2(std::min(box1.min().x(), box2.min().x()),
-                       std::min(box1.min().y(), box2.min().y())),
-                Point2(std::max(box1.max().x(), box2.max().x()),
-                       std::max(box1.max().y(), box2.max().y())));
+    auto copy = new Node;
+    copy->is_leaf = is_leaf;
+    copy->mbr = mbr;
+    copy->boxes = boxes;
+    copy->ids = ids;
+    copy->weights = weights;
+    copy->children = children;
+    copy->count = count;
+    copy->weight = weight;
+    for (auto child : children)
+        retain(child);
+    return copy;
 }
 
-double rtse::Box2::enlarge_area(const Box2 &other) const
+void rtse::Node::retain(Node *node)
 {
-    Box2 merged_box = merge(*this, other);
-    return merged_box.area() - this->area();
+    node->refs.fetch_add(1, std::memory_order_relaxed);
 }
 
-bool rtse::Box2::operator==(const Box2 &other) const noexcept
+// drop one reference and free the subtree parts nobody else shares
+void rtse::Node::release(Node *node)
 {
-    return eq(min().x(), other.min().x()) && eq(max().x(), other.max().x()) &&
-           eq(min().y(), other.min().y()) && eq(max().y(), other.max().y());
+    if (!node || node->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+    for (auto child : node->children)
+        release(child);
+    delete node;
 }
 
-bool rtse::Box2::operator!=(const Box2 &other) const noexcept
-{
-    return !(*this == other);
-}
+size_t rtse::Node::size() const { return boxes.size(); }
 
-std::pair<const rtse::Box2 &, int> rtse::Node::entry(size_t i) const
+void rtse::Node::reserve(size_t n)
 {
-    return {boxes[i], ids[i]};
+    boxes.reserve(n);
+    if (is_leaf)
+    {
+        ids.reserve(n);
+        weights.reserve(n);
+    }
+    else
+        children.reserve(n);
 }
 
-size_t rtse::Node::size() const { return boxes.size(); }
-
-void rtse::Node::push_back(const rtse::Box2 &box, int id)
+void rtse::Node::push_back(const rtse::Box2 &box, int id, double weight)
 {
     boxes.push_back(box);
     ids.push_back(id);
+    weights.push_back(weight);
     mbr = Box2::merge(mbr, box);
+    count += 1;
+    this->weight += weight;
 }
 
 void rtse::Node::push_back(Node *ptr)
@@ -93,6 +77,8 @@ void rtse::Node::push_back(Node *ptr)
     boxes.push_back(ptr->mbr);
     children.push_back(ptr);
     mbr = Box2::merge(mbr, ptr->mbr);
+    count += ptr->count;
+    weight += ptr->weight;
 }
 
 void rtse::Node::update_mbr()
@@ -102,6 +88,25 @@ void rtse::Node::update_mbr()
         mbr = Box2::merge(mbr, boxes[i]);
 }
 
+void rtse::Node::update_aggregate()
+{
+    if (is_leaf)
+    {
+        count = ids.size();
+        weight = 0;
+        for (auto w : weights)
+            weight += w;
+        return;
+    }
+    count = 0;
+    weight = 0;
+    for (auto child : children)
+    {
+        count += child->count;
+        weight += child->weight;
+    }
+}
+
 rtse::RTree::RTree()
 {
     root = new Node;
@@ -111,41 +116,570 @@ rtse::RTree::RTree()
     m = 2;
 }
 
-rtse::RTree::~RTree() { deallocate(root); }
-
-void rtse::RTree::deallocate(Node *root)
+rtse::RTree::RTree(const std::vector<Box2> &boxes, const std::vector<int> &ids,
+                   const std::vector<double> &weights)
+    : RTree()
 {
-    if (!root)
+    // the buffers come from callers such as Python, so they are checked
+    if (boxes.size() != ids.size() ||
+        (!weights.empty() && weights.size() != ids.size()))
+        throw std::invalid_argument(
+            "boxes, ids and weights should have the same length");
+    if (boxes.empty())
         return;
-    if (!root->is_leaf)
+
+    id_to_box.reserve(ids.size());
+    for (size_t i = 0; i < ids.size(); i++)
+        if (!id_to_box.emplace(ids[i], boxes[i]).second)
+            throw std::invalid_argument("duplicate id " +
+                                        std::to_string(ids[i]));
+
+    // leaf level: consecutive runs of the STR order become leaves
+    auto order = str_order(boxes, M);
+    auto bounds = str_groups(order.size(), M);
+    NodeVec level;
+    level.reserve(bounds.size() - 1);
+    for (size_t g = 0; g + 1 < bounds.size(); g++)
     {
-        for (auto child : root->children)
-            deallocate(child);
+        auto leaf = new Node;
+        leaf->is_leaf = true;
+        leaf->reserve(bounds[g + 1] - bounds[g]);
+        for (size_t i = bounds[g]; i < bounds[g + 1]; i++)
+            leaf->push_back(boxes[order[i]], ids[order[i]],
+                            weights.empty() ? 1.0 : weights[order[i]]);
+        level.push_back(leaf);
     }
+    // upper levels: pack node MBRs the same way until one root remains
+    while (level.size() > 1)
+        level = pack_level(level);
+
     delete root;
+    root = level.front();
+}
+
+// LRU list of cached results plus a tree over the cached windows, so that
+// invalidation only visits the windows overlapping a changed box
+struct rtse::RTree::QueryCache
+{
+    struct Key
+    {
+        double min_x, min_y, max_x, max_y;
+        bool operator==(const Key &other) const noexcept
+        {
+            return min_x == other.min_x && min_y == other.min_y &&
+                   max_x == other.max_x && max_y == other.max_y;
+        }
+    };
+    struct KeyHash
+    {
+        size_t operator()(const Key &key) const noexcept
+        {
+            std::hash<double> h;
+            size_t seed = h(key.min_x);
+            for (double v : {key.min_y, key.max_x, key.max_y})
+                seed ^= h(v) + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+            return seed;
+        }
+    };
+    struct Entry
+    {
+        Key key;
+        int slot;
+        std::vector<int> ids;
+    };
+    using Iter = std::list<Entry>::iterator;
+
+    explicit QueryCache(size_t capacity) { stats.capacity = capacity; }
+
+    static Key key_of(const Box2 &box)
+    {
+        return {box.min().x(), box.min().y(), box.max().x(), box.max().y()};
+    }
+
+    bool lookup(const Box2 &box, std::vector<int> &ids)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = by_key.find(key_of(box));
+        if (it == by_key.end())
+        {
+            ++stats.misses;
+            return false;
+        }
+        ++stats.hits;
+        lru.splice(lru.begin(), lru, it->second);
+        ids = it->second->ids;
+        return true;
+    }
+
+    void store(const Box2 &box, const std::vector<int> &ids)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto key = key_of(box);
+        if (by_key.count(key))
+            return;
+        if (lru.size() == stats.capacity)
+            evict(std::prev(lru.end()));
+        int slot = next_slot++;
+        lru.push_front({key, slot, ids});
+        by_key.emplace(key, lru.begin());
+        by_slot.emplace(slot, lru.begin());
+        windows.insert_entry(box, slot, 1.0);
+        stats.size = lru.size();
+    }
+
+    void invalidate(const Box2 &changed)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto slot : windows.query_range(changed))
+        {
+            evict(by_slot.at(slot));
+            ++stats.invalidations;
+        }
+        stats.size = lru.size();
+    }
+
+    void evict(Iter it)
+    {
+        windows.erase_entry(it->slot);
+        by_slot.erase(it->slot);
+        by_key.erase(it->key);
+        lru.erase(it);
+    }
+
+    std::list<Entry> lru; // most recently used first
+    std::unordered_map<Key, Iter, KeyHash> by_key;
+    std::unordered_map<int, Iter> by_slot;
+    RTree windows; // cached query boxes by slot
+    int next_slot = 0;
+    QueryCacheStats stats;
+    std::mutex mutex;
+};
+
+rtse::RTree::RTree(RTree &&other) noexcept
+    : root(std::exchange(other.root, nullptr)), M(other.M), m(other.m),
+      id_to_box(std::move(other.id_to_box)),
+      subscriptions(std::move(other.subscriptions)),
+      next_query_id(other.next_query_id), events(std::move(other.events)),
+      cache(std::move(other.cache)), trace(std::move(other.trace)),
+      pool(std::move(other.pool)), task_threshold(other.task_threshold)
+{
 }
 
-void rtse::RTree::insert(const Box2 &box, int id)
+rtse::RTree &rtse::RTree::operator=(RTree &&other) noexcept
 {
-    std::cout << "[RTree] insert " << id << "." << std::endl;
+    if (this != &other)
+    {
+        Node::release(root);
+        root = std::exchange(other.root, nullptr);
+        M = other.M;
+        m = other.m;
+        id_to_box = std::move(other.id_to_box);
+        subscriptions = std::move(other.subscriptions);
+        next_query_id = other.next_query_id;
+        events = std::move(other.events);
+        cache = std::move(other.cache);
+        trace = std::move(other.trace);
+        pool = std::move(other.pool);
+        task_threshold = other.task_threshold;
+    }
+    return *this;
+}
 
-    assert(id_to_box.find(id) == id_to_box.end()); // id should be unique
-    id_to_box[id] = box;
+rtse::RTree::~RTree() { Node::release(root); }
 
-    auto vec = choose_leaf(root, box);
-    insert_to_node(vec, vec.size() - 1, box, id);
+rtse::Snapshot rtse::RTree::snapshot() const
+{
+    return Snapshot(root, id_to_box.size());
 }
 
-void rtse::RTree::erase(int id)
+rtse::QueryCursor rtse::RTree::query_cursor(const Box2 &query_box) const
+{
+    return QueryCursor(root, query_box);
+}
+
+rtse::QueryCursor::QueryCursor(Node *root, const Box2 &query_box)
+    : root(root), query_box(query_box)
+{
+    Node::retain(root);
+    if (query_box.overlap(root->mbr))
+        stack.push_back({root, 0});
+}
+
+rtse::QueryCursor::QueryCursor(QueryCursor &&other) noexcept
+    : root(std::exchange(other.root, nullptr)), query_box(other.query_box),
+      stack(std::move(other.stack))
+{
+}
+
+rtse::QueryCursor &rtse::QueryCursor::operator=(QueryCursor &&other) noexcept
+{
+    std::swap(root, other.root);
+    std::swap(query_box, other.query_box);
+    std::swap(stack, other.stack);
+    return *this;
+}
+
+rtse::QueryCursor::~QueryCursor() { Node::release(root); }
+
+std::vector<int> rtse::QueryCursor::next(size_t max_ids)
+{
+    assert(max_ids > 0); // an empty chunk marks the end
+    std::vector<int> ids;
+    while (!stack.empty() && ids.size() < max_ids)
+    {
+        auto &frame = stack.back();
+        const Node *node = frame.node;
+        if (frame.next == node->size())
+        {
+            stack.pop_back();
+            continue;
+        }
+        size_t i = frame.next++;
+        if (!query_box.overlap(node->boxes[i]))
+            continue;
+        if (node->is_leaf)
+            ids.push_back(node->ids[i]);
+        else
+            stack.push_back({node->children[i], 0});
+    }
+    return ids;
+}
+
+bool rtse::QueryCursor::done() const { return stack.empty(); }
+
+rtse::Snapshot::Snapshot(Node *root, size_t count) : root(root), count(count)
+{
+    Node::retain(root);
+}
+
+rtse::Snapshot::Snapshot(const Snapshot &other)
+    : Snapshot(other.root, other.count)
+{
+}
+
+rtse::Snapshot::Snapshot(Snapshot &&other) noexcept
+    : root(std::exchange(other.root, nullptr)), count(other.count)
+{
+}
+
+rtse::Snapshot &rtse::Snapshot::operator=(Snapshot other) noexcept
+{
+    std::swap(root, other.root);
+    std::swap(count, other.count);
+    return *this;
+}
+
+rtse::Snapshot::~Snapshot() { Node::release(root); }
+
+size_t rtse::Snapshot::size() const { return count; }
+
+size_t rtse::Snapshot::query_count(const Box2 &query_box) const
+{
+    size_t count = 0;
+    double weight = 0;
+    RTree::aggregate_queried(root, query_box, count, weight);
+    return count;
+}
+
+double rtse::Snapshot::query_sum(const Box2 &query_box) const
+{
+    size_t count = 0;
+    double weight = 0;
+    RTree::aggregate_queried(root, query_box, count, weight);
+    return weight;
+}
+
+std::vector<int> rtse::Snapshot::query_range(const Box2 &query_box) const
+{
+    std::vector<int> satisfied_ids;
+    RTree::find_queried_boxes(root, query_box, satisfied_ids);
+    return satisfied_ids;
+}
+
+rtse::QueryCursor rtse::Snapshot::query_cursor(const Box2 &query_box) const
+{
+    return QueryCursor(root, query_box);
+}
+
+rtse::RadiusResult rtse::Snapshot::query_radius(const Point2 &center, double r,
+                                                bool with_distances) const
+{
+    RadiusResult result;
+    if (r >= 0 && root->size() > 0)
+        RTree::find_within_radius(root, center, r * r, with_distances, result);
+    return result;
+}
+
+// copy-on-write: a node referenced once may be modified in place, a shared
+// one is replaced by a private copy whose children become shared instead
+rtse::Node *rtse::RTree::detach(Node *node)
 {
-    std::cout << "[RTree] erase " << id << "." << std::endl;
+    if (node->refs.load(std::memory_order_acquire) == 1)
+        return node;
+    auto copy = node->clone();
+    Node::release(node);
+    return copy;
+}
+
+// detach the path [leaf, ..., root] top-down, so that the mutation never
+// touches a snapshot's nodes
+void rtse::RTree::detach_path(NodeVec &vec)
+{
+    for (size_t level = vec.size(); level-- > 0;)
+    {
+        auto node = vec[level], copy = detach(node);
+        if (copy == node)
+            continue;
+        if (level + 1 == vec.size())
+            root = copy;
+        else
+            std::replace(vec[level + 1]->children.begin(),
+                         vec[level + 1]->children.end(), node, copy);
+        vec[level] = copy;
+    }
+}
+
+rtse::NodeVec rtse::RTree::pack_level(const NodeVec &children) const
+{
+    std::vector<Box2> mbrs;
+    mbrs.reserve(children.size());
+    for (auto child : children)
+        mbrs.push_back(child->mbr);
 
+    auto order = str_order(mbrs, M);
+    auto bounds = str_groups(order.size(), M);
+    NodeVec parents;
+    parents.reserve(bounds.size() - 1);
+    for (size_t g = 0; g + 1 < bounds.size(); g++)
+    {
+        auto parent = new Node;
+        parent->is_leaf = false;
+        parent->reserve(bounds[g + 1] - bounds[g]);
+        for (size_t i = bounds[g]; i < bounds[g + 1]; i++)
+            parent->push_back(children[order[i]]);
+        parents.push_back(parent);
+    }
+    return parents;
+}
+
+// moves the entries of the k-th run in `less` order into [k * run_size,
+// (k + 1) * run_size) without sorting inside the runs; STR only needs to
+// know which slice, and then which node, an entry falls into
+template <typename It, typename Less>
+static void partition_runs(It begin, It end, size_t run_size, Less less)
+{
+    size_t n = end - begin;
+    if (n <= run_size)
+        return;
+    size_t runs = (n + run_size - 1) / run_size;
+    It mid = begin + runs / 2 * run_size;
+    std::nth_element(begin, mid, end, less);
+    partition_runs(begin, mid, run_size, less);
+    partition_runs(mid, end, run_size, less);
+}
+
+std::vector<size_t> rtse::str_order(const std::vector<Box2> &boxes,
+                                    size_t node_capacity)
+{
+    std::vector<size_t> order(boxes.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (boxes.size() <= node_capacity)
+        return order;
+
+    size_t nodes = (boxes.size() + node_capacity - 1) / node_capacity;
+    size_t slices = static_cast<size_t>(std::ceil(std::sqrt(nodes)));
+    size_t slice_size = slices * node_capacity;
+
+    // the centers travel with the index, so that the partitions compare
+    // contiguous keys instead of reaching into boxes through the index;
+    // centers scaled by 2 are enough for ordering
+    struct Keyed
+    {
+        double x, y;
+        size_t index;
+    };
+    std::vector<Keyed> keyed(boxes.size());
+    for (size_t i = 0; i < boxes.size(); i++)
+        keyed[i] = {boxes[i].min().x() + boxes[i].max().x(),
+                    boxes[i].min().y() + boxes[i].max().y(), i};
+
+    // vertical slices by x-center, then tiles inside each slice by y-center
+    partition_runs(keyed.begin(), keyed.end(), slice_size,
+                   [](const Keyed &a, const Keyed &b) { return a.x < b.x; });
+    for (size_t begin = 0; begin < keyed.size(); begin += slice_size)
+    {
+        auto end = std::min(keyed.size(), begin + slice_size);
+        partition_runs(keyed.begin() + begin, keyed.begin() + end,
+                       node_capacity,
+                       [](const Keyed &a, const Keyed &b) { return a.y < b.y; });
+    }
+    for (size_t k = 0; k < keyed.size(); k++)
+        order[k] = keyed[k].index;
+    return order;
+}
+
+// full nodes of node_capacity entries: str_order() slices hold a multiple
+// of node_capacity, so no node straddles two slices. Only the very last
+// node can be short; it is evened out with its predecessor
+std::vector<size_t> rtse::str_groups(size_t n, size_t node_capacity)
+{
+    std::vector<size_t> bounds;
+    bounds.reserve(n / node_capacity + 2);
+    for (size_t i = 0; i < n; i += node_capacity)
+        bounds.push_back(i);
+    bounds.push_back(n);
+    size_t k = bounds.size() - 1; // number of groups
+    if (k >= 2 && 2 * (bounds[k] - bounds[k - 1]) < node_capacity)
+        bounds[k - 1] = (bounds[k - 2] + n) / 2;
+    return bounds;
+}
+
+void rtse::RTree::insert(const Box2 &box, int id, double weight)
+{
+    assert(id_to_box.find(id) == id_to_box.end()); // id should be unique
+    if (trace)
+        trace->write({TraceOp::insert, id, box, weight});
+    insert_entry(box, id, weight);
+    if (cache)
+        cache->invalidate(box);
+    notify(box, id, true);
+}
+
+void rtse::RTree::erase(int id)
+{
     assert(id_to_box.find(id) != id_to_box.end()); // erased id should exist
+    if (trace)
+        trace->write({TraceOp::erase, id, Box2(), 1.0});
+    auto removed_box = id_to_box[id];
+    erase_entry(id);
+    if (cache)
+        cache->invalidate(removed_box);
+    notify(removed_box, id, false);
+}
+
+void rtse::RTree::update(int id, const rtse::Box2 &new_box)
+{
+    assert(id_to_box.find(id) != id_to_box.end()); // updated id should exist
+    if (trace)
+        trace->write({TraceOp::update, id, new_box, 1.0});
+
+    auto old_box = id_to_box[id];
+    auto weight = erase_entry(id);
+    insert_entry(new_box, id, weight);
+    if (cache)
+    {
+        cache->invalidate(old_box);
+        cache->invalidate(new_box);
+    }
+    if (!subscriptions)
+        return;
 
+    // only queries matching exactly one of the two boxes see a change
+    auto before = subscriptions->query_range(old_box);
+    auto after = subscriptions->query_range(new_box);
+    std::sort(before.begin(), before.end());
+    std::sort(after.begin(), after.end());
+    std::vector<int> left, entered;
+    std::set_difference(before.begin(), before.end(), after.begin(),
+                        after.end(), std::back_inserter(left));
+    std::set_difference(after.begin(), after.end(), before.begin(),
+                        before.end(), std::back_inserter(entered));
+    for (auto query_id : left)
+        events.push_back({query_id, id, false});
+    for (auto query_id : entered)
+        events.push_back({query_id, id, true});
+}
+
+void rtse::RTree::erase_many(const std::vector<int> &ids)
+{
+    std::unordered_set<int> pending;
+    std::vector<Entry> targets;
+    for (auto id : ids)
+    {
+        assert(id_to_box.find(id) != id_to_box.end()); // erased id should exist
+        if (pending.insert(id).second)
+            targets.push_back({id_to_box[id], id, 0});
+    }
+    if (targets.empty())
+        return;
+
+    // visit the targets in packing order, so that neighbouring targets
+    // share their path down the tree
+    std::vector<Box2> target_boxes;
+    target_boxes.reserve(targets.size());
+    for (auto &target : targets)
+        target_boxes.push_back(target.box);
+    std::vector<Entry> sorted;
+    sorted.reserve(targets.size());
+    for (auto i : str_order(target_boxes, M))
+        sorted.push_back(targets[i]);
+    targets.swap(sorted);
+
+    std::vector<size_t> selected(targets.size());
+    std::iota(selected.begin(), selected.end(), 0);
+    std::vector<Entry> orphans;
+    root = detach(root);
+    erase_batch(root, targets, selected, pending, orphans);
+    assert(pending.empty()); // every id should be found
+    for (auto id : ids)
+        id_to_box.erase(id);
+    finish_batch(orphans);
+
+    for (auto &target : targets)
+    {
+        if (trace)
+            trace->write({TraceOp::erase, target.id, Box2(), 1.0});
+        if (cache)
+            cache->invalidate(target.box);
+        notify(target.box, target.id, false);
+    }
+}
+
+std::vector<int> rtse::RTree::erase_range(const Box2 &query_box)
+{
+    std::vector<Entry> removed, orphans;
+    root = detach(root);
+    erase_window(root, query_box, removed, orphans);
+    std::vector<int> ids;
+    ids.reserve(removed.size());
+    for (auto &entry : removed)
+    {
+        id_to_box.erase(entry.id);
+        ids.push_back(entry.id);
+    }
+    finish_batch(orphans);
+
+    for (auto &entry : removed)
+    {
+        if (trace)
+            trace->write({TraceOp::erase, entry.id, Box2(), 1.0});
+        if (cache)
+            cache->invalidate(entry.box);
+        notify(entry.box, entry.id, false);
+    }
+    return ids;
+}
+
+void rtse::RTree::insert_entry(const Box2 &box, int id, double weight)
+{
+    id_to_box[id] = box;
+
+    auto vec = choose_leaf(root, box);
+    detach_path(vec);
+    insert_to_node(vec, vec.size() - 1, box, id, weight);
+}
+
+// returns the weight of the erased entry
+double rtse::RTree::erase_entry(int id)
+{
     auto removed_box = id_to_box[id];
     NodeVec vec(0);
     choose_leaf(vec, root, removed_box, id);
     assert(!vec.empty()); // DFS path should exist
+    detach_path(vec);
+    auto leaf = vec.front();
+    auto it = std::find(leaf->ids.begin(), leaf->ids.end(), id);
+    double weight = leaf->weights[it - leaf->ids.begin()];
     remove_node(vec, vec.size() - 1, id);
 
     id_to_box.erase(id);
@@ -158,25 +692,158 @@ void rtse::RTree::erase(int id)
     }
     if (!root->is_leaf && root->size() == 0)
         root->is_leaf = true;
+    return weight;
 }
 
-void rtse::RTree::update(int id, const rtse::Box2 &new_box)
+// queue an event for every standing query overlapping the changed box
+void rtse::RTree::notify(const Box2 &box, int id, bool entered)
 {
-    std::cout << "[RTree] update " << id << "." << std::endl;
+    if (!subscriptions)
+        return;
+    for (auto query_id : subscriptions->query_range(box))
+        events.push_back({query_id, id, entered});
+}
 
-    assert(id_to_box.find(id) != id_to_box.end()); // updated id should exist
+int rtse::RTree::subscribe(const Box2 &query_box)
+{
+    if (!subscriptions)
+        subscriptions = std::make_unique<RTree>();
+    int query_id = next_query_id++;
+    subscriptions->insert_entry(query_box, query_id, 1.0);
+    // not a traced query_range(): the trace records the caller's queries
+    std::vector<int> ids;
+    find_queried_boxes(root, query_box, ids);
+    for (auto id : ids)
+        events.push_back({query_id, id, true});
+    return query_id;
+}
 
-    erase(id);
-    insert(new_box, id);
+bool rtse::RTree::unsubscribe(int query_id)
+{
+    if (!subscriptions || subscriptions->id_to_box.find(query_id) ==
+                              subscriptions->id_to_box.end())
+        return false;
+    subscriptions->erase_entry(query_id);
+    return true;
+}
+
+std::vector<rtse::RangeEvent> rtse::RTree::drain_events()
+{
+    return std::exchange(events, {});
 }
 
 std::vector<int> rtse::RTree::query_range(const rtse::Box2 &query_box) const
 {
+    if (trace)
+        trace->write({TraceOp::query_range, 0, query_box, 1.0});
     std::vector<int> satisfied_ids;
-    find_queried_boxes(root, query_box, satisfied_ids);
+    if (cache && !query_box.is_empty() &&
+        cache->lookup(query_box, satisfied_ids))
+        return satisfied_ids;
+    if (pool && expected_hits(root, query_box) >= task_threshold)
+    {
+        // per-slot buffers, concatenated once every task finished
+        std::vector<std::vector<int>> buffers(pool->size() + 1);
+        WorkStealingPool::Group group;
+        find_queried_parallel(root, query_box, buffers, pool->size(), group);
+        pool->wait(group);
+        size_t total = 0;
+        for (auto &buffer : buffers)
+            total += buffer.size();
+        satisfied_ids.reserve(total);
+        for (auto &buffer : buffers)
+            satisfied_ids.insert(satisfied_ids.end(), buffer.begin(),
+                                 buffer.end());
+    }
+    else
+        find_queried_boxes(root, query_box, satisfied_ids);
+    if (cache && !query_box.is_empty())
+        cache->store(query_box, satisfied_ids);
     return satisfied_ids;
 }
 
+size_t rtse::RTree::query_count(const rtse::Box2 &query_box) const
+{
+    size_t count = 0;
+    double weight = 0;
+    aggregate_queried(root, query_box, count, weight);
+    return count;
+}
+
+double rtse::RTree::query_sum(const rtse::Box2 &query_box) const
+{
+    size_t count = 0;
+    double weight = 0;
+    aggregate_queried(root, query_box, count, weight);
+    return weight;
+}
+
+rtse::RadiusResult rtse::RTree::query_radius(const rtse::Point2 &center,
+                                             double r,
+                                             bool with_distances) const
+{
+    RadiusResult result;
+    if (r >= 0 && root->size() > 0)
+        find_within_radius(root, center, r * r, with_distances, result);
+    return result;
+}
+
+size_t rtse::RTree::size() const { return id_to_box.size(); }
+
+void rtse::RTree::enable_query_cache(size_t capacity)
+{
+    if (capacity == 0)
+        cache.reset();
+    else
+        cache = std::make_unique<QueryCache>(capacity);
+}
+
+rtse::QueryCacheStats rtse::RTree::query_cache_stats() const
+{
+    if (!cache)
+        return {};
+    std::lock_guard<std::mutex> lock(cache->mutex);
+    return cache->stats;
+}
+
+void rtse::RTree::enable_parallel_queries(unsigned threads,
+                                          size_t task_threshold)
+{
+    pool.reset();
+    if (threads > 1)
+        pool = std::make_unique<WorkStealingPool>(threads - 1);
+    this->task_threshold = std::max<size_t>(task_threshold, 1);
+}
+
+// the current entries are recorded first, so that a replay starts from the
+// same contents
+void rtse::RTree::start_trace(const std::string &path)
+{
+    trace = std::make_unique<TraceWriter>(path);
+    std::vector<const Node *> stack{root};
+    while (!stack.empty())
+    {
+        const Node *node = stack.back();
+        stack.pop_back();
+        if (!node->is_leaf)
+        {
+            stack.insert(stack.end(), node->children.begin(),
+                         node->children.end());
+            continue;
+        }
+        for (size_t i = 0; i < node->size(); i++)
+            trace->write(
+                {TraceOp::load, node->ids[i], node->boxes[i], node->weights[i]});
+    }
+}
+
+void rtse::RTree::stop_trace()
+{
+    if (trace)
+        trace->flush();
+    trace.reset();
+}
+
 // choose the leaf node for insertion
 rtse::NodeVec rtse::RTree::choose_leaf(Node *cur_node,
                                        const rtse::Box2 &box) const
@@ -211,10 +878,12 @@ rtse::NodeVec rtse::RTree::choose_leaf(Node *cur_node,
 
 // insertion detail implementation
 void rtse::RTree::insert_to_node(const rtse::NodeVec &vec, size_t level,
-                                 const rtse::Box2 &box, int id)
+                                 const rtse::Box2 &box, int id, double weight)
 {
     auto cur_node = vec[level];
     cur_node->mbr = Box2::merge(cur_node->mbr, box);
+    cur_node->count += 1;
+    cur_node->weight += weight;
     if (!cur_node->is_leaf)
     {
         // enlarge the mbr of child node
@@ -224,12 +893,13 @@ void rtse::RTree::insert_to_node(const rtse::NodeVec &vec, size_t level,
             if (cur_node->children[i] == child)
                 cur_node->boxes[i] = Box2::merge(cur_node->boxes[i], box);
         }
-        insert_to_node(vec, level - 1, box, id); // recursive insertion
+        insert_to_node(vec, level - 1, box, id, weight); // recursive insertion
     }
     else
     {
         cur_node->boxes.push_back(box);
         cur_node->ids.push_back(id);
+        cur_node->weights.push_back(weight);
         // overflow occurrs
         if (cur_node->boxes.size() > M)
         {
@@ -263,27 +933,28 @@ std::pair<rtse::Node *, rtse::Node *> rtse::RTree::split(rtse::Node *node) const
                 continue;
             }
             int cur_id = node->ids[cur_idx];
+            double cur_weight = node->weights[cur_idx];
             Box2 &cur_box = node->boxes[cur_idx];
             double enlarged_A = node_A->mbr.enlarge_area(cur_box),
                    enlarged_B = node_B->mbr.enlarge_area(cur_box);
             // choose smaller enlarged area
             if (enlarged_A < enlarged_B)
-                node_A->push_back(cur_box, cur_id);
+                node_A->push_back(cur_box, cur_id, cur_weight);
             else if (enlarged_A > enlarged_B)
-                node_B->push_back(cur_box, cur_id);
+                node_B->push_back(cur_box, cur_id, cur_weight);
             // if tie, chooese smaller mbr
             else if (node_A->mbr.area() < node_B->mbr.area())
-                node_A->push_back(cur_box, cur_id);
+                node_A->push_back(cur_box, cur_id, cur_weight);
             else if (node_A->mbr.area() > node_B->mbr.area())
-                node_B->push_back(cur_box, cur_id);
+                node_B->push_back(cur_box, cur_id, cur_weight);
             // if tie again, choose smaller node
             else if (node_A->size() < node_B->size())
-                node_A->push_back(cur_box, cur_id);
+                node_A->push_back(cur_box, cur_id, cur_weight);
             else if (node_A->size() > node_B->size())
-                node_B->push_back(cur_box, cur_id);
+                node_B->push_back(cur_box, cur_id, cur_weight);
             // if still tie, add to node_A
             else
-                node_A->push_back(cur_box, cur_id);
+                node_A->push_back(cur_box, cur_id, cur_weight);
 
             node->allocated[cur_idx++] = true;
             --remained;
@@ -297,7 +968,8 @@ std::pair<rtse::Node *, rtse::Node *> rtse::RTree::split(rtse::Node *node) const
                     ++cur_idx;
                     continue;
                 }
-                node_A->push_back(node->boxes[cur_idx], node->ids[cur_idx]);
+                node_A->push_back(node->boxes[cur_idx], node->ids[cur_idx],
+                                  node->weights[cur_idx]);
                 node->allocated[cur_idx++] = true;
                 --remained;
             }
@@ -311,7 +983,8 @@ std::pair<rtse::Node *, rtse::Node *> rtse::RTree::split(rtse::Node *node) const
                     ++cur_idx;
                     continue;
                 }
-                node_B->push_back(node->boxes[cur_idx], node->ids[cur_idx]);
+                node_B->push_back(node->boxes[cur_idx], node->ids[cur_idx],
+                                  node->weights[cur_idx]);
                 node->allocated[cur_idx++] = true;
                 --remained;
             }
@@ -410,6 +1083,9 @@ void rtse::RTree::adjust(const rtse::NodeVec &vec, size_t level,
         find(node->boxes.begin(), node->boxes.end(), vec[level - 1]->mbr);
     if (it_box != node->boxes.end())
         node->boxes.erase(it_box);
+    // the split halves bring the overflow node's aggregate back
+    node->count -= overflow_node->count;
+    node->weight -= overflow_node->weight;
 
     node->push_back(new_nodes.first);
     node->push_back(new_nodes.second);
@@ -520,8 +1196,10 @@ rtse::RTree::choose_boxes(Node *node) const
     ptrB->is_leaf = ptrA->is_leaf = node->is_leaf;
     if (node->is_leaf)
     {
-        ptrA->push_back(node->boxes[idxA], node->ids[idxA]);
-        ptrB->push_back(node->boxes[idxB], node->ids[idxB]);
+        ptrA->push_back(node->boxes[idxA], node->ids[idxA],
+                        node->weights[idxA]);
+        ptrB->push_back(node->boxes[idxB], node->ids[idxB],
+                        node->weights[idxB]);
     }
     else
     {
@@ -533,7 +1211,7 @@ rtse::RTree::choose_boxes(Node *node) const
 
 // resursively find the overlaped node
 void rtse::RTree::find_queried_boxes(Node *node, const rtse::Box2 &target,
-                                     std::vector<int> &ids) const
+                                     std::vector<int> &ids)
 {
     if (node->is_leaf)
     {
@@ -555,6 +1233,116 @@ void rtse::RTree::find_queried_boxes(Node *node, const rtse::Box2 &target,
     }
 }
 
+// resursively aggregate the overlaped entries, whole subtrees at once
+// subtree count scaled by the share of the node's MBR inside the target
+double rtse::RTree::expected_hits(const Node *node, const rtse::Box2 &target)
+{
+    const Box2 &mbr = node->mbr;
+    if (!target.overlap(mbr))
+        return 0;
+    double w = std::min(mbr.max().x(), target.max().x()) -
+               std::max(mbr.min().x(), target.min().x());
+    double h = std::min(mbr.max().y(), target.max().y()) -
+               std::max(mbr.min().y(), target.min().y());
+    double area = mbr.area();
+    if (!(area > 0))
+        return static_cast<double>(node->count);
+    return node->count * std::min(1.0, w * h / area);
+}
+
+// children expected to yield task_threshold hits become tasks, the rest is
+// searched serially into the buffer of the running slot
+void rtse::RTree::find_queried_parallel(Node *node, const rtse::Box2 &target,
+                                        std::vector<std::vector<int>> &buffers,
+                                        unsigned slot,
+                                        WorkStealingPool::Group &group) const
+{
+    if (node->is_leaf)
+    {
+        find_queried_boxes(node, target, buffers[slot]);
+        return;
+    }
+    for (size_t i = 0; i < node->size(); i++)
+    {
+        if (!target.overlap(node->boxes[i]))
+            continue;
+        Node *child = node->children[i];
+        if (!child->is_leaf && expected_hits(child, target) >= task_threshold)
+            pool->spawn(group,
+                        [this, child, &target, &buffers, &group](unsigned s)
+                        { find_queried_parallel(child, target, buffers, s,
+                                                group); });
+        else
+            find_queried_boxes(child, target, buffers[slot]);
+    }
+}
+
+// prune by MINDIST; a node whose MAXDIST is within the radius is taken
+// whole, without testing its entries
+void rtse::RTree::find_within_radius(const Node *node,
+                                     const rtse::Point2 &center, double sq_r,
+                                     bool with_distances, RadiusResult &result)
+{
+    if (node->mbr.max_sq_dist(center) <= sq_r)
+    {
+        collect_all(node, center, with_distances, result);
+        return;
+    }
+    for (size_t i = 0; i < node->size(); i++)
+    {
+        double sq_dist = node->boxes[i].min_sq_dist(center);
+        if (sq_dist > sq_r)
+            continue;
+        if (node->is_leaf)
+        {
+            result.ids.push_back(node->ids[i]);
+            if (with_distances)
+                result.distances.push_back(std::sqrt(sq_dist));
+        }
+        else
+            find_within_radius(node->children[i], center, sq_r,
+                               with_distances, result);
+    }
+}
+
+void rtse::RTree::collect_all(const Node *node, const rtse::Point2 &center,
+                              bool with_distances, RadiusResult &result)
+{
+    if (!node->is_leaf)
+    {
+        for (auto child : node->children)
+            collect_all(child, center, with_distances, result);
+        return;
+    }
+    result.ids.insert(result.ids.end(), node->ids.begin(), node->ids.end());
+    if (with_distances)
+        for (auto &box : node->boxes)
+            result.distances.push_back(std::sqrt(box.min_sq_dist(center)));
+}
+
+void rtse::RTree::aggregate_queried(const Node *node, const rtse::Box2 &target,
+                                    size_t &count, double &weight)
+{
+    if (target.contains(node->mbr))
+    {
+        count += node->count;
+        weight += node->weight;
+        return;
+    }
+    for (size_t i = 0; i < node->size(); i++)
+    {
+        if (!target.overlap(node->boxes[i]))
+            continue;
+        if (node->is_leaf)
+        {
+            count += 1;
+            weight += node->weights[i];
+        }
+        else
+            aggregate_queried(node->children[i], target, count, weight);
+    }
+}
+
 void rtse::RTree::make_new_root(
     const std::pair<rtse::Node *, rtse::Node *> &split_pair)
 {
@@ -617,6 +1405,7 @@ rtse::Box2 rtse::RTree::remove_node(const NodeVec &vec, size_t level, int id)
         // assert(found == true); // matched id should be found
         node->ids.erase(node->ids.begin() + idx);
         node->boxes.erase(node->boxes.begin() + idx);
+        node->weights.erase(node->weights.begin() + idx);
     }
     else
     {
@@ -645,7 +1434,151 @@ rtse::Box2 rtse::RTree::remove_node(const NodeVec &vec, size_t level, int id)
         }
     }
     node->update_mbr();
+    node->update_aggregate();
     return node->mbr;
 }
 
+// remove the pending targets below a detached node; the targets overlapping
+// each child are handed down together and every child is fixed up once
+void rtse::RTree::erase_batch(Node *node, const std::vector<Entry> &targets,
+                              const std::vector<size_t> &selected,
+                              std::unordered_set<int> &pending,
+                              std::vector<Entry> &orphans)
+{
+    if (node->is_leaf)
+    {
+        size_t kept = 0;
+        for (size_t i = 0; i < node->size(); i++)
+        {
+            if (pending.erase(node->ids[i]))
+                continue;
+            node->boxes[kept] = node->boxes[i];
+            node->ids[kept] = node->ids[i];
+            node->weights[kept] = node->weights[i];
+            ++kept;
+        }
+        node->boxes.resize(kept);
+        node->ids.resize(kept);
+        node->weights.resize(kept);
+    }
+    else
+    {
+        std::vector<std::vector<size_t>> per_child(node->size());
+        for (auto t : selected)
+            for (size_t i = 0; i < node->size(); i++)
+                if (node->boxes[i].overlap(targets[t].box))
+                    per_child[i].push_back(t);
+        // children are erased while iterating, so walk them backwards
+        for (size_t i = node->size(); i-- > 0;)
+        {
+            if (per_child[i].empty())
+                continue;
+            node->children[i] = detach(node->children[i]);
+            erase_batch(node->children[i], targets, per_child[i], pending,
+                        orphans);
+            settle_child(node, i, orphans);
+        }
+    }
+    node->update_mbr();
+    node->update_aggregate();
+}
+
+// remove every entry overlapping the window below a detached node; subtrees
+// inside the window are dropped whole
+void rtse::RTree::erase_window(Node *node, const Box2 &window,
+                               std::vector<Entry> &removed,
+                               std::vector<Entry> &orphans)
+{
+    if (node->is_leaf)
+    {
+        size_t kept = 0;
+        for (size_t i = 0; i < node->size(); i++)
+        {
+            if (window.overlap(node->boxes[i]))
+            {
+                removed.push_back(
+                    {node->boxes[i], node->ids[i], node->weights[i]});
+                continue;
+            }
+            node->boxes[kept] = node->boxes[i];
+            node->ids[kept] = node->ids[i];
+            node->weights[kept] = node->weights[i];
+            ++kept;
+        }
+        node->boxes.resize(kept);
+        node->ids.resize(kept);
+        node->weights.resize(kept);
+    }
+    else
+    {
+        for (size_t i = 0; i < node->size();)
+        {
+            if (!window.overlap(node->boxes[i]))
+            {
+                ++i;
+                continue;
+            }
+            if (window.contains(node->boxes[i]))
+            {
+                collect_entries(node->children[i], removed);
+                Node::release(node->children[i]);
+                node->children.erase(node->children.begin() + i);
+                node->boxes.erase(node->boxes.begin() + i);
+                continue;
+            }
+            node->children[i] = detach(node->children[i]);
+            erase_window(node->children[i], window, removed, orphans);
+            if (!settle_child(node, i, orphans))
+                ++i;
+        }
+    }
+    node->update_mbr();
+    node->update_aggregate();
+}
+
+// after a batch shrank the i-th child: drop it when empty, dissolve it into
+// orphans when it is an under-full leaf, otherwise refresh its box.
+// returns whether the child was removed
+bool rtse::RTree::settle_child(Node *node, size_t i, std::vector<Entry> &orphans)
+{
+    auto child = node->children[i];
+    if (child->size() > 0 && (!child->is_leaf || child->size() >= m))
+    {
+        node->boxes[i] = child->mbr;
+        return false;
+    }
+    collect_entries(child, orphans);
+    Node::release(child);
+    node->children.erase(node->children.begin() + i);
+    node->boxes.erase(node->boxes.begin() + i);
+    return true;
+}
+
+void rtse::RTree::collect_entries(const Node *node, std::vector<Entry> &entries)
+{
+    if (node->is_leaf)
+    {
+        for (size_t i = 0; i < node->size(); i++)
+            entries.push_back({node->boxes[i], node->ids[i], node->weights[i]});
+        return;
+    }
+    for (auto child : node->children)
+        collect_entries(child, entries);
+}
+
+// shrink the root and reinsert the entries of dissolved leaves
+void rtse::RTree::finish_batch(const std::vector<Entry> &orphans)
+{
+    while (!root->is_leaf && root->size() == 1)
+    {
+        auto old_root = root;
+        root = root->children[0];
+        delete old_root;
+    }
+    if (!root->is_leaf && root->size() == 0)
+        root->is_leaf = true;
+    for (auto &orphan : orphans)
+        insert_entry(orphan.box, orphan.id, orphan.weight);
+}
+
 void hello_core() { std::cout << "RTSE core initialized." << std::endl; }
\ No newline at end of file
@@ -1,7 +1,13 @@
 #pragma once
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <limits>
 #include <memory>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace rtse
@@ -14,86 +20,416 @@ struct Point2
 {
     Point2() = default;
     Point2(double x_, double y_) : m_x(x_), m_y(y_) {};
-    double x() const;
-    double y() const;
+    double x() const { return m_x; }
+    double y() const { return m_y; }
 
   private:
     double m_x, m_y;
 };
 
+// The empty box is the inverted-infinity sentinel min = (+inf, +inf),
+// max = (-inf, -inf): it is the identity of merge() and fails every
+// overlap and containment test by plain comparisons, so none of the
+// primitives below needs an emptiness branch
 struct Box2
 {
-    Box2();
-    Box2(const Point2 &p1, const Point2 &p2);
-    const Point2 &min() const;
-    const Point2 &max() const;
-    bool is_empty() const;
-    static Box2 from_point(const Point2 &p);
-    double area() const;
-    bool overlap(const Box2 &other) const;
-    static Box2 merge(const Box2 &box1, const Box2 &box2);
-    double enlarge_area(const Box2 &other) const;
-    bool operator==(const Box2 &other) const noexcept;
-    bool operator!=(const Box2 &other) const noexcept;
+    Box2() : m_min(inf, inf), m_max(-inf, -inf) {}
+    Box2(const Point2 &p1, const Point2 &p2)
+        : m_min(std::min(p1.x(), p2.x()), std::min(p1.y(), p2.y())),
+          m_max(std::max(p1.x(), p2.x()), std::max(p1.y(), p2.y()))
+    {
+    }
+    const Point2 &min() const { return m_min; }
+    const Point2 &max() const { return m_max; }
+    bool is_empty() const
+    {
+        // written as !(min <= max) so that NaN bounds count as empty
+        bool x_axis = !(m_min.x() <= m_max.x());
+        bool y_axis = !(m_min.y() <= m_max.y());
+        return x_axis | y_axis;
+    }
+    static Box2 from_point(const Point2 &p) { return Box2(p, p); }
+    double area() const
+    {
+        return std::max(0.0, m_max.x() - m_min.x()) *
+               std::max(0.0, m_max.y() - m_min.y());
+    }
+    bool overlap(const Box2 &other) const
+    {
+        // the intersection is inverted on an axis unless both intersect it
+        bool x_axis = std::max(m_min.x(), other.m_min.x()) <=
+                      std::min(m_max.x(), other.m_max.x());
+        bool y_axis = std::max(m_min.y(), other.m_min.y()) <=
+                      std::min(m_max.y(), other.m_max.y());
+        return x_axis & y_axis;
+    }
+    bool contains(const Box2 &other) const
+    {
+        bool x_axis =
+            (m_min.x() <= other.m_min.x()) & (other.m_max.x() <= m_max.x());
+        bool y_axis =
+            (m_min.y() <= other.m_min.y()) & (other.m_max.y() <= m_max.y());
+        bool non_empty = !other.is_empty();
+        return x_axis & y_axis & non_empty;
+    }
+    // squared distance from p to the nearest / farthest point of the box,
+    // infinite for the empty box
+    double min_sq_dist(const Point2 &p) const
+    {
+        double dx = std::max({m_min.x() - p.x(), 0.0, p.x() - m_max.x()});
+        double dy = std::max({m_min.y() - p.y(), 0.0, p.y() - m_max.y()});
+        return dx * dx + dy * dy;
+    }
+    double max_sq_dist(const Point2 &p) const
+    {
+        double dx = std::max(p.x() - m_min.x(), m_max.x() - p.x());
+        double dy = std::max(p.y() - m_min.y(), m_max.y() - p.y());
+        return dx * dx + dy * dy;
+    }
+    static Box2 merge(const Box2 &box1, const Box2 &box2)
+    {
+        Box2 merged;
+        merged.m_min = Point2(std::min(box1.m_min.x(), box2.m_min.x()),
+                              std::min(box1.m_min.y(), box2.m_min.y()));
+        merged.m_max = Point2(std::max(box1.m_max.x(), box2.m_max.x()),
+                              std::max(box1.m_max.y(), box2.m_max.y()));
+        return merged;
+    }
+    double enlarge_area(const Box2 &other) const
+    {
+        return merge(*this, other).area() - area();
+    }
+    bool operator==(const Box2 &other) const noexcept
+    {
+        if (is_empty() || other.is_empty())
+            return is_empty() && other.is_empty();
+        return eq(m_min.x(), other.m_min.x()) &&
+               eq(m_max.x(), other.m_max.x()) &&
+               eq(m_min.y(), other.m_min.y()) && eq(m_max.y(), other.m_max.y());
+    }
+    bool operator!=(const Box2 &other) const noexcept
+    {
+        return !(*this == other);
+    }
 
   private:
-    bool m_is_empty;
+    static constexpr double inf = std::numeric_limits<double>::infinity();
     Point2 m_min;
     Point2 m_max;
 };
 
+// Box2 in single precision, half its size. The bounds are rounded outwards,
+// so the float box always covers the double one: overlap() never misses a
+// hit, and the few false positives are discarded by an exact Box2 test
+struct Box2f
+{
+    Box2f() : m_min_x(inf), m_min_y(inf), m_max_x(-inf), m_max_y(-inf) {}
+    explicit Box2f(const Box2 &box)
+        : m_min_x(round_down(box.min().x())),
+          m_min_y(round_down(box.min().y())),
+          m_max_x(round_up(box.max().x())), m_max_y(round_up(box.max().y()))
+    {
+    }
+    bool is_empty() const
+    {
+        bool x_axis = !(m_min_x <= m_max_x);
+        bool y_axis = !(m_min_y <= m_max_y);
+        return x_axis | y_axis;
+    }
+    bool overlap(const Box2f &other) const
+    {
+        bool x_axis = std::max(m_min_x, other.m_min_x) <=
+                      std::min(m_max_x, other.m_max_x);
+        bool y_axis = std::max(m_min_y, other.m_min_y) <=
+                      std::min(m_max_y, other.m_max_y);
+        return x_axis & y_axis;
+    }
+    // the covering Box2, exact in double precision
+    Box2 to_box2() const
+    {
+        if (is_empty())
+            return Box2();
+        return Box2(Point2(m_min_x, m_min_y), Point2(m_max_x, m_max_y));
+    }
+
+  private:
+    static constexpr float inf = std::numeric_limits<float>::infinity();
+    static constexpr double float_max = std::numeric_limits<float>::max();
+    // finite values beyond the float range are clamped before the cast,
+    // which would be undefined for them; NaN widens to infinity
+    static float round_down(double v)
+    {
+        if (!(v >= -float_max))
+            return -inf;
+        if (v > float_max)
+            return v == inf ? inf : static_cast<float>(float_max);
+        float f = static_cast<float>(v);
+        return f > v ? std::nextafter(f, -inf) : f;
+    }
+    static float round_up(double v)
+    {
+        if (!(v <= float_max))
+            return inf;
+        if (v < -float_max)
+            return v == -inf ? -inf : -static_cast<float>(float_max);
+        float f = static_cast<float>(v);
+        return f < v ? std::nextafter(f, inf) : f;
+    }
+    float m_min_x, m_min_y, m_max_x, m_max_y;
+};
+
 struct Node
 {
     bool is_leaf;
     Box2 mbr;
     std::vector<Box2> boxes;
     std::vector<int> ids;
+    std::vector<double> weights; // leaf only, parallel to ids
     std::vector<Node *> children;
     std::vector<bool> allocated;
+    // subtree aggregates: number of entries and sum of their weights
+    size_t count = 0;
+    double weight = 0;
+    // number of parents/roots referencing this node, shared nodes (> 1) are
+    // copied before they are modified
+    std::atomic<size_t> refs{1};
+    Node *clone() const;
+    static void retain(Node *node);
+    static void release(Node *node);
     std::pair<const Box2 &, int> entry(size_t i) const;
     size_t size() const;
-    void push_back(const Box2 &box, int id);
+    void reserve(size_t n); // is_leaf must be set first
+    void push_back(const Box2 &box, int id, double weight);
     void push_back(Node *ptr);
     void update_mbr();
+    void update_aggregate();
 };
 
 using NodeVec = std::vector<Node *>;
 
+// Sort-Tile-Recursive order of boxes for packing nodes of given capacity:
+// every run of node_capacity entries is one tile, in no particular order
+// inside the tile
+std::vector<size_t> str_order(const std::vector<Box2> &boxes,
+                              size_t node_capacity);
+// node boundaries over an str_order() of n entries: node g packs the
+// entries [bounds[g], bounds[g + 1]); empty input gives {0}
+std::vector<size_t> str_groups(size_t n, size_t node_capacity);
+
+class TraceWriter;
+
+// enter/leave notification produced for a standing range query
+struct RangeEvent
+{
+    int query_id;
+    int id;
+    bool entered;
+};
+
+// parallel ids and distances returned by query_radius(); distances stay
+// empty unless they were requested
+struct RadiusResult
+{
+    std::vector<int> ids;
+    std::vector<double> distances;
+};
+
+// counters of the optional query_range result cache
+struct QueryCacheStats
+{
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t invalidations = 0;
+    size_t size = 0;
+    size_t capacity = 0;
+};
+
+// resumable query_range(): the traversal state is an explicit stack, and
+// ids are handed out in caller-sized chunks. The cursor holds a reference
+// to the root it started from, so it keeps iterating that version even if
+// the tree is mutated or destroyed meanwhile
+class QueryCursor
+{
+  public:
+    QueryCursor(QueryCursor &&other) noexcept;
+    QueryCursor &operator=(QueryCursor &&other) noexcept;
+    ~QueryCursor();
+    QueryCursor(const QueryCursor &) = delete;
+    QueryCursor &operator=(const QueryCursor &) = delete;
+    // up to max_ids further ids; empty once the traversal is finished
+    std::vector<int> next(size_t max_ids);
+    bool done() const;
+
+  private:
+    friend class RTree;
+    friend class Snapshot;
+    QueryCursor(Node *root, const Box2 &query_box);
+    struct Frame
+    {
+        const Node *node;
+        size_t next; // index of the next entry to test
+    };
+    Node *root;
+    Box2 query_box;
+    std::vector<Frame> stack;
+};
+
+// immutable view of an RTree at the time snapshot() was called; it shares
+// nodes with the live tree, which path-copies whatever it mutates afterwards
+class Snapshot
+{
+  public:
+    Snapshot(const Snapshot &other);
+    Snapshot(Snapshot &&other) noexcept;
+    Snapshot &operator=(Snapshot other) noexcept;
+    ~Snapshot();
+    size_t size() const;
+    std::vector<int> query_range(const Box2 &query_box) const;
+    size_t query_count(const Box2 &query_box) const;
+    double query_sum(const Box2 &query_box) const;
+    QueryCursor query_cursor(const Box2 &query_box) const;
+    RadiusResult query_radius(const Point2 &center, double r,
+                              bool with_distances = false) const;
+
+  private:
+    friend class RTree;
+    Snapshot(Node *root, size_t count);
+    Node *root;
+    size_t count;
+};
+
 class RTree
 {
   public:
     RTree();
+    // packed (STR) construction from parallel box/id(/weight) buffers;
+    // throws std::invalid_argument on mismatched lengths or repeated ids
+    RTree(const std::vector<Box2> &boxes, const std::vector<int> &ids,
+          const std::vector<double> &weights = {});
     ~RTree();
     RTree(const RTree&) = delete;
     RTree& operator=(const RTree&) = delete;
-    RTree(RTree&&) = delete;
-    RTree& operator=(RTree&&) = delete;
-    void insert(const Box2 &box, int id);
+    // a moved-from tree may only be destroyed or assigned to
+    RTree(RTree &&other) noexcept;
+    RTree &operator=(RTree &&other) noexcept;
+    // weight is summed by query_sum()
+    void insert(const Box2 &box, int id, double weight = 1.0);
     void erase(int id);
     void update(int id, const Box2 &new_box);
+    // batch deletes in a single traversal: every touched node is fixed up
+    // once and under-full leaves are dissolved and reinserted at the end
+    void erase_many(const std::vector<int> &ids);
+    std::vector<int> erase_range(const Box2 &query_box);
     std::vector<int> query_range(const Box2 &query_box) const;
+    // the same ids as query_range(), produced incrementally
+    QueryCursor query_cursor(const Box2 &query_box) const;
+    // aggregates over the objects overlapping query_box; subtrees whose MBR
+    // lies inside query_box contribute their stored aggregate directly
+    size_t query_count(const Box2 &query_box) const;
+    double query_sum(const Box2 &query_box) const;
+    // objects whose box lies within distance r of center; the distance of
+    // an object is the distance from center to the nearest point of its box
+    RadiusResult query_radius(const Point2 &center, double r,
+                              bool with_distances = false) const;
+    size_t size() const;
+    // O(1) consistent view; safe to query while this tree keeps mutating
+    Snapshot snapshot() const;
+    // standing range queries: subscribe() reports the current matches as
+    // enter events, later mutations report enter/leave events for the
+    // affected queries only; events are buffered until drained.
+    // unsubscribe() returns false if query_id is not subscribed
+    int subscribe(const Box2 &query_box);
+    bool unsubscribe(int query_id);
+    std::vector<RangeEvent> drain_events();
+    // opt-in LRU cache of query_range results keyed by the query box; a
+    // mutation evicts only the cached windows overlapping the changed boxes.
+    // capacity == 0 disables the cache, re-enabling starts a fresh one
+    void enable_query_cache(size_t capacity);
+    QueryCacheStats query_cache_stats() const;
+    // splits large query_range() calls across a work-stealing pool of
+    // threads - 1 workers plus the caller: subtrees expected to hold at
+    // least task_threshold hits (subtree count scaled by the overlapped
+    // share of its MBR) become tasks. Queries below the threshold stay
+    // serial; threads <= 1 turns the pool off
+    void enable_parallel_queries(unsigned threads,
+                                 size_t task_threshold = 4096);
+    // optional binary trace of every insert/erase/update/query_range (see
+    // trace.h); batch deletes are recorded as the single erases they imply,
+    // and the entries present at start_trace() as leading load records
+    void start_trace(const std::string &path);
+    void stop_trace();
+    // parallel file ingest followed by a packed build (defined in io.cpp)
+    static RTree from_csv(const std::string &path, unsigned threads = 0);
+    static RTree from_wkt(const std::string &path, unsigned threads = 0);
 
   private:
     Node *root;
     size_t M, m;
     std::unordered_map<int, Box2> id_to_box;
-    // private function for destructor
-    void deallocate(Node *root);
+    // registered query boxes, indexed by query id in a second tree
+    std::unique_ptr<RTree> subscriptions;
+    int next_query_id = 0;
+    std::vector<RangeEvent> events;
+    struct QueryCache;
+    std::unique_ptr<QueryCache> cache;
+    std::unique_ptr<TraceWriter> trace;
+    std::unique_ptr<WorkStealingPool> pool;
+    size_t task_threshold = 0;
+    friend class Snapshot;
+    // mutations without tracing, caching or notifications
+    void insert_entry(const Box2 &box, int id, double weight);
+    double erase_entry(int id);
+    void notify(const Box2 &box, int id, bool entered);
+    // private function for copy-on-write mutation
+    static Node *detach(Node *node);
+    void detach_path(NodeVec &vec);
+    // private function for packed construction
+    NodeVec pack_level(const NodeVec &children) const;
     // private function for insert()
     NodeVec choose_leaf(Node *cur_node, const Box2 &box) const;
     void insert_to_node(const NodeVec &vec, size_t level, const Box2 &box,
-                        int id);
+                        int id, double weight);
     std::pair<Node *, Node *> split(Node *node) const;
     void adjust(const NodeVec &vec, size_t level,
                 const std::pair<Node *, Node *> &split_pair);
     std::pair<Node *, Node *> choose_boxes(Node *node) const;
     void make_new_root(const std::pair<Node *, Node *> &split_pair);
     // private function for query_range()
-    void find_queried_boxes(Node *node, const Box2 &target,
-                            std::vector<int> &ids) const;
+    static void find_queried_boxes(Node *node, const Box2 &target,
+                                   std::vector<int> &ids);
+    static double expected_hits(const Node *node, const Box2 &target);
+    void find_queried_parallel(Node *node, const Box2 &target,
+                               std::vector<std::vector<int>> &buffers,
+                               unsigned slot,
+                               WorkStealingPool::Group &group) const;
+    // private function for query_count() and query_sum()
+    static void aggregate_queried(const Node *node, const Box2 &target,
+                                  size_t &count, double &weight);
+    // private function for query_radius()
+    static void find_within_radius(const Node *node, const Point2 &center,
+                                   double sq_r, bool with_distances,
+                                   RadiusResult &result);
+    static void collect_all(const Node *node, const Point2 &center,
+                            bool with_distances, RadiusResult &result);
     // private function for erase()
     void choose_leaf(NodeVec &vec, Node *node, const Box2 &box, int id) const;
     Box2 remove_node(const NodeVec &vec, size_t level, int id);
+    // private function for erase_many() and erase_range()
+    struct Entry
+    {
+        Box2 box;
+        int id;
+        double weight;
+    };
+    void erase_batch(Node *node, const std::vector<Entry> &targets,
+                     const std::vector<size_t> &selected,
+                     std::unordered_set<int> &pending,
+                     std::vector<Entry> &orphans);
+    void erase_window(Node *node, const Box2 &window,
+                      std::vector<Entry> &removed, std::vector<Entry> &orphans);
+    bool settle_child(Node *node, size_t i, std::vector<Entry> &orphans);
+    static void collect_entries(const Node *node, std::vector<Entry> &entries);
+    void finish_batch(const std::vector<Entry> &orphans);
 };
 
 }; // namespace rtse
\ No newline at end of file
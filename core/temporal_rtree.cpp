@@ -0,0 +1,144 @@
+#include "temporal_rtree.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+// marks a ring slot that holds no bucket
+static constexpr long long no_bucket = std::numeric_limits<long long>::min();
+
+rtse::TemporalRTree::TemporalRTree(double bucket_width, size_t num_buckets)
+    : bucket_width(bucket_width), ring(num_buckets), newest(0),
+      started(false), count(0)
+{
+    // a zero ring would divide by zero in slot(), and a width that is not
+    // finite and positive turns every timestamp into a NaN bucket
+    if (!(bucket_width > 0) || !std::isfinite(bucket_width))
+        throw std::invalid_argument(
+            "bucket_width should be finite and positive, got " +
+            std::to_string(bucket_width));
+    if (num_buckets == 0)
+        throw std::invalid_argument("num_buckets should be at least 1");
+}
+
+void rtse::TemporalRTree::insert(const Box2 &box, int id, double t)
+{
+    long long k = bucket_of(t);
+    if (!started || k > newest)
+        advance(t);
+    if (k <= newest - static_cast<long long>(ring.size()))
+        return; // already expired
+
+    Bucket &bucket = slot(k);
+    bucket.index = k;
+    bucket.recent.insert(box, id);
+    if (k == newest)
+    {
+        bucket.staged_boxes.push_back(box);
+        bucket.staged_ids.push_back(id);
+    }
+    ++count;
+}
+
+void rtse::TemporalRTree::advance(double now)
+{
+    long long k = bucket_of(now);
+    if (!started)
+    {
+        started = true;
+        newest = k;
+        return;
+    }
+    if (k <= newest)
+        return;
+
+    if (slot(newest).index == newest)
+        close(slot(newest));
+    long long oldest = k - static_cast<long long>(ring.size()) + 1;
+    for (auto &bucket : ring)
+        if (bucket.index != no_bucket && bucket.index < oldest)
+            drop(bucket);
+    newest = k;
+}
+
+std::vector<int> rtse::TemporalRTree::query_range(const Box2 &query_box) const
+{
+    std::vector<int> ids;
+    for (auto &bucket : ring)
+        if (bucket.index != no_bucket)
+            query_bucket(bucket, query_box, ids);
+    return ids;
+}
+
+std::vector<int> rtse::TemporalRTree::query_range(const Box2 &query_box,
+                                                  double t0, double t1) const
+{
+    std::vector<int> ids;
+    if (!(t0 <= t1))
+        return ids;
+    long long k0 = bucket_of(t0), k1 = bucket_of(t1);
+    for (auto &bucket : ring)
+        if (bucket.index != no_bucket && k0 <= bucket.index &&
+            bucket.index <= k1)
+            query_bucket(bucket, query_box, ids);
+    return ids;
+}
+
+size_t rtse::TemporalRTree::size() const { return count; }
+
+size_t rtse::TemporalRTree::buckets() const
+{
+    size_t n = 0;
+    for (auto &bucket : ring)
+        n += bucket.index != no_bucket;
+    return n;
+}
+
+size_t rtse::TemporalRTree::packed_buckets() const
+{
+    size_t n = 0;
+    for (auto &bucket : ring)
+        n += bucket.index != no_bucket && bucket.packed.size() > 0;
+    return n;
+}
+
+// clamped, so that infinite bounds of a time range stay comparable
+long long rtse::TemporalRTree::bucket_of(double t) const
+{
+    constexpr double limit = 1e18;
+    return static_cast<long long>(
+        std::floor(std::clamp(t / bucket_width, -limit, limit)));
+}
+
+rtse::TemporalRTree::Bucket &rtse::TemporalRTree::slot(long long index)
+{
+    long long n = static_cast<long long>(ring.size());
+    return ring[((index % n) + n) % n];
+}
+
+// the open bucket's entries become one packed tree and its flat and
+// dynamic copies are released
+void rtse::TemporalRTree::close(Bucket &bucket)
+{
+    if (bucket.staged_ids.empty())
+        return;
+    bucket.packed = PackedRTree(bucket.staged_boxes, bucket.staged_ids);
+    bucket.staged_boxes = std::vector<Box2>();
+    bucket.staged_ids = std::vector<int>();
+    bucket.recent = RTree();
+}
+
+void rtse::TemporalRTree::drop(Bucket &bucket)
+{
+    count -= bucket.packed.size() + bucket.recent.size();
+    bucket = Bucket();
+}
+
+void rtse::TemporalRTree::query_bucket(const Bucket &bucket,
+                                       const Box2 &query_box,
+                                       std::vector<int> &ids)
+{
+    bucket.packed.query_range(query_box, ids);
+    auto recent = bucket.recent.query_range(query_box);
+    ids.insert(ids.end(), recent.begin(), recent.end());
+}
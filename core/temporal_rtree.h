@@ -0,0 +1,62 @@
+#pragma once
+#include "packed_rtree.h"
+#include "rtree.h"
+#include <limits>
+#include <vector>
+
+namespace rtse
+{
+
+// Sliding-window index over timestamped boxes: a ring of num_buckets
+// buckets, each covering bucket_width time units. Inserts go to the bucket
+// of their timestamp; once the clock moves past a bucket it is repacked
+// into a PackedRTree, and buckets older than the window are dropped whole.
+// Time filtering has bucket granularity: a bucket overlapping [t0, t1]
+// contributes all of its hits.
+class TemporalRTree
+{
+  public:
+    // throws std::invalid_argument unless bucket_width is finite and
+    // positive and num_buckets is at least 1
+    TemporalRTree(double bucket_width, size_t num_buckets);
+    // entries older than the window are ignored; a newer timestamp advances
+    // the clock first. ids should be unique within a bucket
+    void insert(const Box2 &box, int id, double t);
+    // closes the buckets before now and expires those out of the window
+    void advance(double now);
+    std::vector<int> query_range(const Box2 &query_box) const;
+    std::vector<int> query_range(const Box2 &query_box, double t0,
+                                 double t1) const;
+    size_t size() const;
+    // number of buckets holding entries, and how many of them are packed
+    size_t buckets() const;
+    size_t packed_buckets() const;
+
+  private:
+    struct Bucket
+    {
+        long long index = std::numeric_limits<long long>::min(); // none
+        // entries of the open bucket, late arrivals of a closed one
+        RTree recent;
+        // the open bucket's entries again, flat, to pack it on close
+        std::vector<Box2> staged_boxes;
+        std::vector<int> staged_ids;
+        PackedRTree packed;
+    };
+    double bucket_width;
+    std::vector<Bucket> ring;
+    long long newest;
+    bool started;
+    size_t count;
+    // private function for bucket addressing
+    long long bucket_of(double t) const;
+    Bucket &slot(long long index);
+    // private function for advance()
+    void close(Bucket &bucket);
+    void drop(Bucket &bucket);
+    // private function for query_range()
+    static void query_bucket(const Bucket &bucket, const Box2 &query_box,
+                             std::vector<int> &ids);
+};
+
+}; // namespace rtse
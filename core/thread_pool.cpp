@@ -0,0 +1,128 @@
+#include "thread_pool.h"
+#include <cassert>
+
+// the pool and slot of the current thread if it is a worker
+static thread_local const rtse::WorkStealingPool *current_pool = nullptr;
+static thread_local unsigned current_slot = 0;
+
+rtse::WorkStealingPool::WorkStealingPool(unsigned workers)
+{
+    for (unsigned i = 0; i <= workers; i++)
+        queues.push_back(std::make_unique<Queue>());
+    for (unsigned i = 0; i < workers; i++)
+        threads.emplace_back([this, i]() { work(i); });
+}
+
+rtse::WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &thread : threads)
+        thread.join();
+}
+
+unsigned rtse::WorkStealingPool::size() const
+{
+    return static_cast<unsigned>(threads.size());
+}
+
+void rtse::WorkStealingPool::spawn(Group &group, Task task)
+{
+    group.pending.fetch_add(1, std::memory_order_relaxed);
+    Queue &queue = current_pool == this ? *queues[current_slot] : *queues.back();
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.items.push_back({&group, std::move(task)});
+    }
+    queued.fetch_add(1, std::memory_order_release);
+    {
+        // pairs with the predicate check of sleeping workers
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+    }
+    wake.notify_one();
+}
+
+void rtse::WorkStealingPool::wait(Group &group)
+{
+    assert(current_pool != this); // tasks should not wait on the pool
+    Item item;
+    while (group.pending.load(std::memory_order_acquire) > 0)
+    {
+        if (take_from_group(group, item))
+            run(item, size());
+        else
+            std::this_thread::yield();
+    }
+}
+
+void rtse::WorkStealingPool::work(unsigned slot)
+{
+    current_pool = this;
+    current_slot = slot;
+    Item item;
+    while (true)
+    {
+        if (take(slot, item))
+        {
+            run(item, slot);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        wake.wait(lock, [this]()
+                  { return stopping || queued.load() > 0; });
+        if (stopping)
+            return;
+    }
+}
+
+// own deque from the back, then the front of the others
+bool rtse::WorkStealingPool::take(unsigned slot, Item &item)
+{
+    for (size_t k = 0; k < queues.size(); k++)
+    {
+        Queue &queue = *queues[(slot + k) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.items.empty())
+            continue;
+        if (k == 0)
+        {
+            item = std::move(queue.items.back());
+            queue.items.pop_back();
+        }
+        else
+        {
+            item = std::move(queue.items.front());
+            queue.items.pop_front();
+        }
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+bool rtse::WorkStealingPool::take_from_group(const Group &group, Item &item)
+{
+    for (auto &queue : queues)
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        for (auto it = queue->items.begin(); it != queue->items.end(); ++it)
+        {
+            if (it->group != &group)
+                continue;
+            item = std::move(*it);
+            queue->items.erase(it);
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void rtse::WorkStealingPool::run(Item &item, unsigned slot)
+{
+    item.task(slot);
+    item.group->pending.fetch_sub(1, std::memory_order_acq_rel);
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rtse
+{
+
+// Work-stealing pool: every worker owns a deque, pops its own tasks LIFO
+// and steals the oldest task of another deque when it runs dry. Tasks
+// spawned from outside the pool go to a shared deque. A task receives the
+// slot it runs in: 0..size()-1 for the workers, size() for a thread
+// helping inside wait(), which only runs tasks of the group it waits for.
+class WorkStealingPool
+{
+  public:
+    explicit WorkStealingPool(unsigned workers);
+    ~WorkStealingPool();
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    // tasks spawned for one job; wait() returns once all of them ran
+    struct Group
+    {
+        std::atomic<size_t> pending{0};
+    };
+    using Task = std::function<void(unsigned slot)>;
+
+    unsigned size() const;
+    void spawn(Group &group, Task task);
+    void wait(Group &group);
+
+  private:
+    struct Item
+    {
+        Group *group;
+        Task task;
+    };
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Item> items;
+    };
+    // one deque per worker, the shared one last
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    std::atomic<size_t> queued{0};
+    bool stopping = false;
+    void work(unsigned slot);
+    bool take(unsigned slot, Item &item);
+    bool take_from_group(const Group &group, Item &item);
+    void run(Item &item, unsigned slot);
+};
+
+}; // namespace rtse
@@ -0,0 +1,132 @@
+#include "trace.h"
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+static const char trace_magic[8] = {'R', 'T', 'S', 'E', 'T', 'R', 'C', '1'};
+
+// largest record: op, id, box and weight
+static constexpr size_t max_record_size = 1 + 4 + 4 * 8 + 8;
+
+template <typename T> static void put(char *&p, T value)
+{
+    std::memcpy(p, &value, sizeof(T));
+    p += sizeof(T);
+}
+
+static void put_box(char *&p, const rtse::Box2 &box)
+{
+    // the empty box is written as its inverted-infinity bounds
+    put(p, box.min().x());
+    put(p, box.min().y());
+    put(p, box.max().x());
+    put(p, box.max().y());
+}
+
+rtse::TraceWriter::TraceWriter(const std::string &path)
+    : out(path, std::ios::binary | std::ios::trunc)
+{
+    if (!out)
+        throw std::runtime_error("cannot open " + path);
+    out.write(trace_magic, sizeof(trace_magic));
+}
+
+void rtse::TraceWriter::write(const TraceRecord &record)
+{
+    char buffer[max_record_size], *p = buffer;
+    put(p, static_cast<uint8_t>(record.op));
+    if (record.op != TraceOp::query_range)
+        put(p, static_cast<int32_t>(record.id));
+    if (record.op != TraceOp::erase)
+        put_box(p, record.box);
+    if (record.op == TraceOp::insert || record.op == TraceOp::load)
+        put(p, record.weight);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    out.write(buffer, p - buffer);
+}
+
+void rtse::TraceWriter::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    out.flush();
+}
+
+namespace
+{
+
+// bounds-checked cursor over the trace bytes
+struct TraceCursor
+{
+    const std::vector<char> &bytes;
+    size_t pos;
+    const std::string &path;
+
+    template <typename T> T get()
+    {
+        if (bytes.size() - pos < sizeof(T))
+            throw std::runtime_error("truncated trace record at byte " +
+                                     std::to_string(pos) + " of " + path);
+        T value;
+        std::memcpy(&value, bytes.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    rtse::Box2 get_box()
+    {
+        double v[4];
+        for (auto &x : v)
+            x = get<double>();
+        if (v[0] > v[2] || v[1] > v[3])
+            return rtse::Box2();
+        return rtse::Box2(rtse::Point2(v[0], v[1]), rtse::Point2(v[2], v[3]));
+    }
+};
+
+} // namespace
+
+std::vector<rtse::TraceRecord> rtse::read_trace(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("cannot open " + path);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(in)),
+                            std::istreambuf_iterator<char>());
+    if (bytes.size() < sizeof(trace_magic) ||
+        std::memcmp(bytes.data(), trace_magic, sizeof(trace_magic)) != 0)
+        throw std::runtime_error("not an rtse trace: " + path);
+
+    std::vector<TraceRecord> records;
+    TraceCursor cursor{bytes, sizeof(trace_magic), path};
+    while (cursor.pos < bytes.size())
+    {
+        size_t start = cursor.pos;
+        TraceRecord record;
+        record.op = static_cast<TraceOp>(cursor.get<uint8_t>());
+        switch (record.op)
+        {
+        case TraceOp::insert:
+        case TraceOp::load:
+            record.id = cursor.get<int32_t>();
+            record.box = cursor.get_box();
+            record.weight = cursor.get<double>();
+            break;
+        case TraceOp::erase:
+            record.id = cursor.get<int32_t>();
+            break;
+        case TraceOp::update:
+            record.id = cursor.get<int32_t>();
+            record.box = cursor.get_box();
+            break;
+        case TraceOp::query_range:
+            record.box = cursor.get_box();
+            break;
+        default:
+            throw std::runtime_error("unknown trace op at byte " +
+                                     std::to_string(start) + " of " + path);
+        }
+        records.push_back(record);
+    }
+    return records;
+}
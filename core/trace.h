@@ -0,0 +1,54 @@
+#pragma once
+#include "rtree.h"
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace rtse
+{
+
+enum class TraceOp : uint8_t
+{
+    insert = 1,
+    erase = 2,
+    update = 3,
+    query_range = 4,
+    load = 5, // entry already present when the trace was started
+};
+
+// one recorded operation; fields not used by the op are left default
+struct TraceRecord
+{
+    TraceOp op;
+    int id = 0;
+    Box2 box;
+    double weight = 1.0;
+};
+
+// Binary trace: the 8-byte magic "RTSETRC1" followed by records of a
+// one-byte op and its arguments in native byte order:
+//   insert       int32 id, 4 x f64 box, f64 weight
+//   load         int32 id, 4 x f64 box, f64 weight
+//   erase        int32 id
+//   update       int32 id, 4 x f64 box
+//   query_range  4 x f64 box
+// A box is stored as xmin, ymin, xmax, ymax; an empty box as +inf, +inf,
+// -inf, -inf. A trace started on a non-empty tree begins with one load
+// record per entry it held. write() may be called from concurrent queries.
+class TraceWriter
+{
+  public:
+    explicit TraceWriter(const std::string &path);
+    void write(const TraceRecord &record);
+    void flush();
+
+  private:
+    std::mutex mutex;
+    std::ofstream out;
+};
+
+std::vector<TraceRecord> read_trace(const std::string &path);
+
+}; // namespace rtse
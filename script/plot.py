@@ -79,6 +79,9 @@ def parse_fixed_win_line(benchmarks):
     pattern_linear = re.compile(
         r"test_linear_fixed_win_1pct\[(?P<N>[\d_]+)\]"
     )
+    pattern_grid = re.compile(
+        r"test_grid_fixed_win_1pct\[(?P<N>[\d_]+)\]"
+    )
 
     table = {}
 
@@ -97,11 +100,37 @@ def parse_fixed_win_line(benchmarks):
             N = int(ml.group("N").replace("_", ""))
             table.setdefault(N, {})["linear"] = mean_s
             continue
+
+        mg = pattern_grid.search(name)
+        if mg:
+            N = int(mg.group("N").replace("_", ""))
+            table.setdefault(N, {})["grid"] = mean_s
+            continue
     
     Ns = sorted(table.keys())
     rtree_mean = [table[N].get("rtree", float("nan")) for N in Ns]
     linear_mean = [table[N].get("linear", float("nan")) for N in Ns]
-    return (Ns, rtree_mean, linear_mean)
+    grid_mean = [table[N].get("grid", float("nan")) for N in Ns]
+    return (Ns, rtree_mean, linear_mean, grid_mean)
+
+def parse_points_win_line(benchmarks):
+    pattern = re.compile(
+        r"test_points_fixed_win_1pct\[(?P<kind>rtree|grid)-(?P<N>[\d_]+)\]"
+    )
+
+    table = {}
+
+    for b in benchmarks:
+        m = pattern.search(b["name"])
+        if not m:
+            continue
+        N = int(m.group("N").replace("_", ""))
+        table.setdefault(N, {})[m.group("kind")] = b["stats"]["mean"]
+
+    Ns = sorted(table.keys())
+    rtree_mean = [table[N].get("rtree", float("nan")) for N in Ns]
+    grid_mean = [table[N].get("grid", float("nan")) for N in Ns]
+    return (Ns, rtree_mean, grid_mean)
 
 def plot_build_time(build_data, out_dir: Path):
     if not build_data:
@@ -186,13 +215,16 @@ def plot_fixed_win_line(fixed_win_data, out_dir: Path):
     
     rtree_ms = [t * 1e3 for t in rtree_mean_s]
     linear_ms = [t * 1e3 for t in linear_mean_s]
+    grid_ms = [t * 1e3 for t in fixed_win_data[3]]
 
     plt.figure()
     plt.plot(Ns, rtree_ms, marker='o', linestyle='-', label="R-tree")
     plt.plot(Ns, linear_ms, marker='x', linestyle='--', label="Linear scan")
+    if any(t == t for t in grid_ms):
+        plt.plot(Ns, grid_ms, marker='s', linestyle='-.', label="Grid + R-tree")
     plt.xlabel("Number of objects (N)")
     plt.ylabel("Per-query latency (ms)")
-    plt.title("Fixed 1% window: R-tree vs. linear scan")
+    plt.title("Fixed 1% window: R-tree vs. grid vs. linear scan")
     plt.grid(True, which="both", linestyle='--', alpha=0.5)
     plt.legend()
     out_path = out_dir / "fixed_win_1pct_line.png"
@@ -200,6 +232,25 @@ def plot_fixed_win_line(fixed_win_data, out_dir: Path):
     plt.close()
     print(f"[plot] saved {out_path}")
 
+def plot_points_win_line(points_data, out_dir: Path):
+    Ns, rtree_mean_s, grid_mean_s = points_data
+    if not Ns:
+        print("No point-workload (1%) benchmarks found.")
+        return
+
+    plt.figure()
+    plt.plot(Ns, [t * 1e3 for t in rtree_mean_s], marker='o', linestyle='-', label="R-tree")
+    plt.plot(Ns, [t * 1e3 for t in grid_mean_s], marker='s', linestyle='-.', label="Grid")
+    plt.xlabel("Number of points (N)")
+    plt.ylabel("Per-query latency (ms)")
+    plt.title("Fixed 1% window on uniform points: R-tree vs. grid")
+    plt.grid(True, which="both", linestyle='--', alpha=0.5)
+    plt.legend()
+    out_path = out_dir / "points_win_1pct_line.png"
+    plt.savefig(out_path, bbox_inches="tight", dpi=150)
+    plt.close()
+    print(f"[plot] saved {out_path}")
+
 def main():
     parser = argparse.ArgumentParser()
     parser.add_argument(
@@ -223,11 +274,13 @@ def main():
     q_table = parse_query_and_baseline(benchs)
     mixed_data = parse_mixed_workload(benchs)
     fixed_data = parse_fixed_win_line(benchs)
+    points_data = parse_points_win_line(benchs)
 
     plot_build_time(build_data, args.out_dir)
     plot_query_vs_baseline(q_table, args.out_dir)
     plot_mixed_workload(mixed_data, args.out_dir)
     plot_fixed_win_line(fixed_data, args.out_dir)
+    plot_points_win_line(points_data, args.out_dir)
 
 if __name__ == "__main__":
     main()
\ No newline at end of file
@@ -1,8 +1,23 @@
+#include "../core/disk_rtree.h"
+#include "../core/grid_index.h"
+#include "../core/io.h"
+#include "../core/packed_rtree.h"
 #include "../core/rtree.h"
+#include "../core/temporal_rtree.h"
+#include "../core/trace.h"
 #include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <gtest/gtest.h>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <optional>
 #include <random>
 #include <set>
+#include <stdexcept>
+#include <thread>
 
 using namespace rtse;
 
@@ -190,4 +205,1098 @@ TEST(RTreeUpdate, NoOpKeepState)
     tree.update(10, box);
     auto vec = tree.query_range(Box2(Point2(0, 0), Point2(2, 2)));
     EXPECT_EQ(vec[0], 10);
-}
\ No newline at end of file
+}
+TEST(RTreeBulkLoad, PackedBuildMatchesBruteForce)
+{
+    std::mt19937 rng(314551132);
+    std::uniform_real_distribution<double> U(0.0, 100.0);
+
+    std::vector<Box2> boxes;
+    std::vector<int> ids;
+    for (int i = 0; i < 1000; i++)
+    {
+        double x = U(rng), y = U(rng);
+        boxes.push_back(Box2(Point2(x, y), Point2(x + 1, y + 1)));
+        ids.push_back(i);
+    }
+    RTree tree(boxes, ids);
+
+    for (int q = 0; q < 50; q++)
+    {
+        Box2 query(Point2(U(rng), U(rng)), Point2(U(rng), U(rng)));
+        std::set<int> expected;
+        for (size_t i = 0; i < boxes.size(); i++)
+            if (query.overlap(boxes[i]))
+                expected.insert(ids[i]);
+        EXPECT_EQ(as_set(tree.query_range(query)), expected);
+    }
+
+    // packed tree stays fully dynamic
+    tree.erase(0);
+    tree.update(1, Box2(Point2(500, 500), Point2(501, 501)));
+    tree.insert(Box2(Point2(600, 600), Point2(601, 601)), 5000);
+    auto far = as_set(tree.query_range(Box2(Point2(400, 400), Point2(700, 700))));
+    EXPECT_EQ(far, (std::set<int>{1, 5000}));
+}
+
+TEST(RTreeBulkLoad, RejectsMismatchedBuffersAndDuplicateIds)
+{
+    std::vector<Box2> boxes = {Box2::from_point(Point2(0, 0)),
+                               Box2::from_point(Point2(1, 1)),
+                               Box2::from_point(Point2(2, 2))};
+    EXPECT_THROW(RTree(boxes, {1, 2}), std::invalid_argument);
+    EXPECT_THROW(RTree(boxes, {1, 2, 3}, {1.0, 2.0}), std::invalid_argument);
+    EXPECT_THROW(RTree(boxes, {1, 2, 1}), std::invalid_argument);
+    RTree tree(boxes, {1, 2, 3}, {1.0, 2.0, 3.0});
+    EXPECT_EQ(tree.size(), 3);
+}
+
+TEST(RTreeBulkLoad, StrLeavesStayInsideSlices)
+{
+    std::mt19937 rng(314551132);
+    std::uniform_real_distribution<double> U(0.0, 1000.0);
+    std::vector<Box2> points;
+    for (int i = 0; i < 20001; i++)
+        points.push_back(Box2::from_point(Point2(U(rng), U(rng))));
+
+    // total leaf area for n = 20000 (a multiple of the capacity) and for
+    // n = 20001; a leaf straddling two slices would span the whole y-range
+    auto leaf_area = [&](size_t n, size_t capacity)
+    {
+        std::vector<Box2> boxes(points.begin(), points.begin() + n);
+        auto order = str_order(boxes, capacity);
+        auto bounds = str_groups(n, capacity);
+        EXPECT_EQ(bounds.front(), 0);
+        EXPECT_EQ(bounds.back(), n);
+        double area = 0;
+        for (size_t g = 0; g + 1 < bounds.size(); g++)
+        {
+            EXPECT_LE(bounds[g + 1] - bounds[g], capacity);
+            EXPECT_GE(2 * (bounds[g + 1] - bounds[g]), capacity);
+            Box2 mbr;
+            for (size_t i = bounds[g]; i < bounds[g + 1]; i++)
+                mbr = Box2::merge(mbr, boxes[order[i]]);
+            area += mbr.area();
+        }
+        return area;
+    };
+    for (size_t capacity : {8, 16})
+        EXPECT_LT(leaf_area(20001, capacity), 1.1 * leaf_area(20000, capacity));
+    EXPECT_EQ(str_groups(5, 8), (std::vector<size_t>{0, 5}));
+    EXPECT_EQ(str_groups(17, 8), (std::vector<size_t>{0, 8, 12, 17}));
+
+    std::vector<int> ids(points.size());
+    std::iota(ids.begin(), ids.end(), 0);
+    RTree packed(points, ids);
+    PackedRTree flat(points, ids);
+    Box2 window(Point2(100, 200), Point2(400, 300));
+    std::set<int> expected;
+    for (size_t i = 0; i < points.size(); i++)
+        if (window.overlap(points[i]))
+            expected.insert(ids[i]);
+    EXPECT_EQ(as_set(packed.query_range(window)), expected);
+    EXPECT_EQ(as_set(flat.query_range(window)), expected);
+}
+
+TEST(RTreeIngest, CsvBoxesPointsAndHeader)
+{
+    auto path = ::testing::TempDir() + "rtse_ingest.csv";
+    {
+        std::ofstream out(path);
+        out << "id,xmin,ymin,xmax,ymax\n"
+            << "1,0,0,1,1\n"
+            << "2, 5.5, 5.5\r\n"
+            << "\n"
+            << "3,-2,-2,-1,-1";
+    }
+    auto buffer = read_csv(path);
+    EXPECT_EQ(buffer.size(), 3);
+
+    auto tree = RTree::from_csv(path);
+    EXPECT_EQ(as_set(tree.query_range(Box2(Point2(0, 0), Point2(6, 6)))),
+              (std::set<int>{1, 2}));
+    EXPECT_EQ(as_set(tree.query_range(Box2(Point2(-3, -3), Point2(-1.5, -1.5)))),
+              (std::set<int>{3}));
+}
+
+TEST(RTreeIngest, CsvParallelChunksMatchSerial)
+{
+    auto path = ::testing::TempDir() + "rtse_ingest_large.csv";
+    {
+        std::ofstream out(path);
+        for (int i = 0; i < 60000; i++)
+            out << i << "," << i % 1000 << "," << i / 1000 << ","
+                << i % 1000 + 0.5 << "," << i / 1000 + 0.5 << "\n";
+    }
+    auto serial = read_csv(path, 1);
+    auto parallel = read_csv(path, 4);
+    EXPECT_EQ(serial.size(), 60000);
+    EXPECT_EQ(serial.ids, parallel.ids);
+    EXPECT_EQ(serial.boxes, parallel.boxes);
+
+    auto tree = RTree::from_csv(path, 4);
+    auto ids = tree.query_range(Box2(Point2(10.2, 20.2), Point2(11.2, 21.2)));
+    EXPECT_EQ(as_set(ids), (std::set<int>{20010, 20011, 21010, 21011}));
+}
+
+TEST(RTreeIngest, WktGeometries)
+{
+    auto path = ::testing::TempDir() + "rtse_ingest.wkt";
+    {
+        std::ofstream out(path);
+        out << "1,POINT (1 2)\n"
+            << "2;LINESTRING(0 0, 4 -3)\n"
+            << "3\t\"POLYGON ((10 10, 12 10, 12 13, 10 10))\"\n"
+            << "4,POINT Z (7 8 100)\n"
+            << "5,MULTIPOINT EMPTY\n";
+    }
+    auto buffer = read_wkt(path);
+    ASSERT_EQ(buffer.size(), 4);
+    EXPECT_EQ(buffer.boxes[1], Box2(Point2(0, -3), Point2(4, 0)));
+    EXPECT_EQ(buffer.boxes[2], Box2(Point2(10, 10), Point2(12, 13)));
+    EXPECT_EQ(buffer.boxes[3], Box2::from_point(Point2(7, 8)));
+
+    auto tree = RTree::from_wkt(path);
+    EXPECT_EQ(as_set(tree.query_range(Box2(Point2(0, 0), Point2(8, 8)))),
+              (std::set<int>{1, 2, 4}));
+}
+
+TEST(RTreeIngest, MalformedRowThrows)
+{
+    auto path = ::testing::TempDir() + "rtse_ingest_bad.csv";
+    {
+        std::ofstream out(path);
+        out << "1,0,0,1,1\n"
+            << "2,0,0,1\n";
+    }
+    EXPECT_THROW(read_csv(path), std::runtime_error);
+    EXPECT_THROW(read_csv(path + ".missing"), std::runtime_error);
+}
+
+TEST(RTreeIngest, DuplicateIdThrows)
+{
+    auto path = ::testing::TempDir() + "rtse_ingest_dup.csv";
+    {
+        std::ofstream out(path);
+        out << "1,0,0,1,1\n"
+            << "2,5,5\n"
+            << "1,2,2,3,3\n";
+    }
+    EXPECT_THROW(read_csv(path), std::runtime_error);
+    EXPECT_THROW(RTree::from_csv(path), std::runtime_error);
+    auto wkt = ::testing::TempDir() + "rtse_ingest_dup.wkt";
+    {
+        std::ofstream out(wkt);
+        out << "7,POINT (1 2)\n"
+            << "7,POINT (3 4)\n";
+    }
+    EXPECT_THROW(RTree::from_wkt(wkt), std::runtime_error);
+}
+
+TEST(RTreeSnapshot, IsolatedFromLaterMutations)
+{
+    std::mt19937 rng(314551132);
+    std::uniform_real_distribution<double> U(0.0, 100.0);
+    auto rand_box = [&]()
+    {
+        double x = U(rng), y = U(rng);
+        return Box2(Point2(x, y), Point2(x + 2, y + 2));
+    };
+
+    RTree tree;
+    std::vector<Box2> oracle;
+    for (int i = 0; i < 200; i++)
+    {
+        oracle.push_back(rand_box());
+        tree.insert(oracle.back(), i);
+    }
+    auto snap = tree.snapshot();
+    auto frozen = oracle;
+
+    for (int i = 0; i < 100; i++)
+    {
+        tree.update(i, rand_box());
+        tree.erase(100 + i);
+        tree.insert(rand_box(), 1000 + i);
+    }
+
+    EXPECT_EQ(snap.size(), 200);
+    for (int q = 0; q < 30; q++)
+    {
+        auto query = rand_box();
+        std::set<int> expected;
+        for (size_t i = 0; i < frozen.size(); i++)
+            if (query.overlap(frozen[i]))
+                expected.insert(i);
+        EXPECT_EQ(as_set(snap.query_range(query)), expected);
+    }
+}
+
+TEST(RTreeSnapshot, OutlivesTreeAndMovedTree)
+{
+    std::optional<Snapshot> snap;
+    {
+        RTree tree;
+        for (int i = 0; i < 50; i++)
+            tree.insert(Box2(Point2(i, i), Point2(i + 1, i + 1)), i);
+        RTree moved(std::move(tree));
+        snap.emplace(moved.snapshot());
+        moved.erase(10);
+
+        RTree assigned;
+        assigned = std::move(moved);
+        auto ids = assigned.query_range(Box2(Point2(9.5, 9.5), Point2(11, 11)));
+        EXPECT_EQ(as_set(ids), (std::set<int>{9, 11}));
+    }
+    auto ids = snap->query_range(Box2(Point2(9.5, 9.5), Point2(11, 11)));
+    EXPECT_EQ(as_set(ids), (std::set<int>{9, 10, 11}));
+}
+
+TEST(RTreeSubscription, EventsTrackMembership)
+{
+    std::mt19937 rng(314551132);
+    std::uniform_real_distribution<double> U(0.0, 100.0);
+    auto rand_box = [&](double side)
+    {
+        double x = U(rng), y = U(rng);
+        return Box2(Point2(x, y), Point2(x + side, y + side));
+    };
+
+    RTree tree;
+    std::vector<std::pair<Box2, int>> oracle;
+    for (int i = 0; i < 100; i++)
+    {
+        oracle.push_back({rand_box(2), i});
+        tree.insert(oracle.back().first, i);
+    }
+
+    std::vector<Box2> fences;
+    std::vector<std::set<int>> members;
+    for (int q = 0; q < 20; q++)
+    {
+        fences.push_back(rand_box(20));
+        EXPECT_EQ(tree.subscribe(fences.back()), q);
+        members.emplace_back();
+    }
+
+    int max_id = 99;
+    for (int step = 0; step < 300; step++)
+    {
+        int op = rng() % 3;
+        if (op == 0)
+        {
+            oracle.push_back({rand_box(2), ++max_id});
+            tree.insert(oracle.back().first, max_id);
+        }
+        else if (op == 1)
+        {
+            int idx = rng() % oracle.size();
+            oracle[idx].first = rand_box(2);
+            tree.update(oracle[idx].second, oracle[idx].first);
+        }
+        else
+        {
+            int idx = rng() % oracle.size();
+            tree.erase(oracle[idx].second);
+            std::swap(oracle[idx], oracle.back());
+            oracle.pop_back();
+        }
+
+        for (auto &event : tree.drain_events())
+        {
+            if (event.entered)
+                EXPECT_TRUE(members[event.query_id].insert(event.id).second);
+            else
+                EXPECT_EQ(members[event.query_id].erase(event.id), 1);
+        }
+        for (size_t q = 0; q < fences.size(); q++)
+        {
+            std::set<int> expected;
+            for (auto &[box, id] : oracle)
+                if (fences[q].overlap(box))
+                    expected.insert(id);
+            EXPECT_EQ(members[q], expected);
+        }
+    }
+
+    EXPECT_TRUE(tree.unsubscribe(0));
+    EXPECT_FALSE(tree.unsubscribe(0));
+    EXPECT_FALSE(tree.unsubscribe(12345));
+    EXPECT_FALSE(RTree().unsubscribe(0));
+    tree.insert(fences[0], 10000);
+    for (auto &event : tree.drain_events())
+        EXPECT_NE(event.query_id, 0);
+}
+
+TEST(RTreeQueryCache, HitsAndTargetedInvalidation)
+{
+    RTree tree;
+    for (int i = 0; i < 100; i++)
+        tree.insert(Box2(Point2(i, i), Point2(i + 1, i + 1)), i);
+    tree.enable_query_cache(2);
+
+    Box2 low(Point2(0, 0), Point2(10, 10)), high(Point2(80, 80), Point2(90, 90));
+    auto low_ids = as_set(tree.query_range(low));
+    tree.query_range(high);
+    EXPECT_EQ(as_set(tree.query_range(low)), low_ids);
+    auto stats = tree.query_cache_stats();
+    EXPECT_EQ(stats.hits, 1);
+    EXPECT_EQ(stats.misses, 2);
+    EXPECT_EQ(stats.size, 2);
+
+    // only the window overlapping the change is evicted
+    tree.insert(Box2(Point2(5, 5), Point2(6, 6)), 1000);
+    stats = tree.query_cache_stats();
+    EXPECT_EQ(stats.invalidations, 1);
+    EXPECT_EQ(stats.size, 1);
+    EXPECT_TRUE(as_set(tree.query_range(low)).count(1000));
+    tree.query_range(high);
+    EXPECT_EQ(tree.query_cache_stats().hits, 2);
+
+    // capacity bound evicts the least recently used window
+    tree.query_range(Box2(Point2(40, 40), Point2(41, 41)));
+    EXPECT_EQ(tree.query_cache_stats().size, 2);
+    tree.query_range(low);
+    EXPECT_EQ(tree.query_cache_stats().hits, 2);
+}
+
+TEST(RTreeQueryCache, RandomMutationsMatchUncached)
+{
+    std::mt19937 rng(314551132);
+    std::uniform_real_distribution<double> U(0.0, 100.0);
+    auto rand_box = [&](double side)
+    {
+        double x = U(rng), y = U(rng);
+        return Box2(Point2(x, y), Point2(x + side, y + side));
+    };
+
+    RTree cached, plain;
+    cached.enable_query_cache(16);
+    std::vector<Box2> windows;
+    for (int i = 0; i < 32; i++)
+        windows.push_back(rand_box(10));
+    for (int i = 0; i < 200; i++)
+    {
+        auto box = rand_box(2);
+        cached.insert(box, i);
+        plain.insert(box, i);
+    }
+    for (int step = 0; step < 500; step++)
+    {
+        if (step % 5 == 0)
+        {
+            int id = rng() % 200;
+            auto box = rand_box(2);
+            cached.update(id, box);
+            plain.update(id, box);
+        }
+        auto &window = windows[rng() % windows.size()];
+        EXPECT_EQ(as_set(cached.query_range(window)),
+                  as_set(plain.query_range(window)));
+    }
+    auto stats = cached.query_cache_stats();
+    EXPECT_GT(stats.hits, 0);
+    EXPECT_EQ(stats.hits + stats.misses, 500);
+}
+
+TEST(GridIndex, MatchesRTreeUnderMixedWorkload)
+{
+    std::mt19937 rng(314551132);
+    std::uniform_real_distribution<double> U(0.0, 1000.0);
+    std::uniform_real_distribution<double> S(0.0, 20.0);
+    auto rand_box = [&]()
+    {
+        double x = U(rng), y = U(rng);
+        return Box2(Point2(x, y), Point2(x + S(rng), y + S(rng)));
+    };
+
+    GridIndex grid(16);
+    RTree tree;
+    std::vector<int> live;
+    for (int i = 0; i < 2000; i++)
+    {
+        auto box = rand_box();
+        grid.insert(box, i);
+        tree.insert(box, i);
+        live.push_back(i);
+    }
+    EXPECT_GT(grid.columns() * grid.rows(), 1);
+    EXPECT_GT(grid.retunes(), 0);
+
+    for (int step = 0; step < 1000; step++)
+    {
+        int idx = rng() % live.size();
+        if (step % 3 == 0)
+        {
+            grid.erase(live[idx]);
+            tree.erase(live[idx]);
+            live[idx] = live.back();
+            live.pop_back();
+        }
+        else
+        {
+            // objects drift outside the tuned extent as well
+            auto box = rand_box();
+            box = Box2(Point2(box.min().x() * 1.5, box.min().y()), box.max());
+            grid.update(live[idx], box);
+            tree.update(live[idx], box);
+        }
+        if (step % 10 == 0)
+        {
+            Box2 query(Point2(U(rng), U(rng)), Point2(U(rng), U(rng)));
+            auto ids = grid.query_range(query);
+            EXPECT_EQ(as_set(ids).size(), ids.size()); // no duplicates
+            EXPECT_EQ(as_set(ids), as_set(tree.query_range(query)));
+        }
+    }
+    EXPECT_EQ(grid.size(), live.size());
+}
+
+TEST(GridIndex, DenseCellsSwitchToTrees)
+{
+    std::vector<Box2> boxes;
+    std::vector<int> ids;
+    // one hot spot inside an otherwise sparse field
+    for (int i = 0; i < 500; i++)
+    {
+        double x = i < 400 ? 0.01 * (i % 20) : 5.0 * (i % 20);
+        double y = i < 400 ? 0.01 * (i / 20) : 5.0 * (i / 20 % 20);
+        boxes.push_back(Box2::from_point(Point2(x, y)));
+        ids.push_back(i);
+    }
+    GridIndex grid(boxes, ids, 32);
+    EXPECT_GT(grid.dense_cells(), 0);
+
+    Box2 hot(Point2(0, 0), Point2(0.1, 0.1));
+    std::set<int> expected;
+    for (size_t i = 0; i < boxes.size(); i++)
+        if (hot.overlap(boxes[i]))
+            expected.insert(ids[i]);
+    EXPECT_EQ(as_set(grid.query_range(hot)), expected);
+}
+
+TEST(RTreeAggregate, CountAndSumMatchBruteForce)
+{
+    std::mt19937 rng(314551132);
+    std::uniform_real_distribution<double> U(0.0, 100.0);
+    auto rand_box = [&]()
+    {
+        double x = U(rng), y = U(rng);
+        return Box2(Point2(x, y), Point2(x + U(rng) / 20, y + U(rng) / 20));
+    };
+
+    RTree tree;
+    std::map<int, std::pair<Box2, double>> oracle;
+    for (int i = 0; i < 300; i++)
+    {
+        auto box = rand_box();
+        double weight = i % 7;
+        oracle[i] = {box, weight};
+        tree.insert(box, i, weight);
+    }
+    for (int step = 0; step < 300; step++)
+    {
+        int id = rng() % 300;
+        if (!oracle.count(id))
+            continue;
+        if (step % 2)
+        {
+            oracle[id].first = rand_box();
+            tree.update(id, oracle[id].first); // keeps its weight
+        }
+        else
+        {
+            oracle.erase(id);
+            tree.erase(id);
+        }
+
+        Box2 query(Point2(U(rng), U(rng)), Point2(U(rng), U(rng)));
+        size_t count = 0;
+        double sum = 0;
+        for (auto &[oid, entry] : oracle)
+        {
+            if (query.overlap(entry.first))
+            {
+                ++count;
+                sum += entry.second;
+            }
+        }
+        EXPECT_EQ(tree.query_count(query), count);
+        EXPECT_NEAR(tree.query_sum(query), sum, 1e-9);
+    }
+    Box2 all(Point2(-1, -1), Point2(200, 200));
+    EXPECT_EQ(tree.query_count(all), oracle.size());
+
+    auto snap = tree.snapshot();
+    tree.insert(Box2(Point2(1, 1), Point2(2, 2)), 1000, 5.0);
+    EXPECT_EQ(snap.query_count(all), oracle.size());
+    EXPECT_EQ(tree.query_count(all), oracle.size() + 1);
+}
+
+TEST(RTreeAggregate, PackedBuildCarriesWeights)
+{
+    std::vector<Box2> boxes;
+    std::vector<int> ids;
+    std::vector<double> weights;
+    for (int i = 0; i < 100; i++)
+    {
+        boxes.push_back(Box2::from_point(Point2(i, i)));
+        ids.push_back(i);
+        weights.push_back(0.5);
+    }
+    RTree weighted(boxes, ids, weights), unweighted(boxes, ids);
+    Box2 query(Point2(10, 10), Point2(29, 29));
+    EXPECT_EQ(weighted.query_count(query), 20);
+    EXPECT_DOUBLE_EQ(weighted.query_sum(query), 10.0);
+    EXPECT_DOUBLE_EQ(unweighted.query_sum(query), 20.0);
+}
+
+TEST(RTreeBatchErase, EraseManyMatchesOracle)
+{
+    std::mt19937 rng(314551132);
+    std::uniform_real_distribution<double> U(0.0, 100.0);
+    auto rand_box = [&]()
+    {
+        double x = U(rng), y = U(rng);
+        return Box2(Point2(x, y), Point2(x + 3, y + 3));
+    };
+
+    RTree tree;
+    std::map<int, Box2> oracle;
+    for (int i = 0; i < 2000; i++)
+    {
+        oracle[i] = rand_box();
+        tree.insert(oracle[i], i, 2.0);
+    }
+    auto snap = tree.snapshot();
+
+    for (int round = 0; round < 5; round++)
+    {
+        std::vector<int> victims;
+        for (auto &[id, box] : oracle)
+            if (rng() % 3 == 0)
+                victims.push_back(id);
+        victims.push_back(victims.front()); // duplicates are ignored
+        tree.erase_many(victims);
+        for (auto id : victims)
+            oracle.erase(id);
+
+        EXPECT_EQ(tree.size(), oracle.size());
+        for (int q = 0; q < 10; q++)
+        {
+            Box2 query(Point2(U(rng), U(rng)), Point2(U(rng), U(rng)));
+            std::set<int> expected;
+            for (auto &[id, box] : oracle)
+                if (query.overlap(box))
+                    expected.insert(id);
+            EXPECT_EQ(as_set(tree.query_range(query)), expected);
+            EXPECT_EQ(tree.query_count(query), expected.size());
+            EXPECT_DOUBLE_EQ(tree.query_sum(query), 2.0 * expected.size());
+        }
+    }
+    EXPECT_EQ(snap.query_count(Box2(Point2(0, 0), Point2(200, 200))), 2000);
+
+    // the tree stays fully dynamic afterwards
+    tree.insert(rand_box(), 5000);
+    tree.erase(5000);
+}
+
+TEST(RTreeBatchErase, EraseRangeRemovesWindow)
+{
+    std::mt19937 rng(314551132);
+    std::uniform_real_distribution<double> U(0.0, 100.0);
+
+    RTree tree;
+    std::map<int, Box2> oracle;
+    for (int i = 0; i < 2000; i++)
+    {
+        double x = U(rng), y = U(rng);
+        oracle[i] = Box2(Point2(x, y), Point2(x + 1, y + 1));
+        tree.insert(oracle[i], i);
+    }
+    int fence = tree.subscribe(Box2(Point2(0, 0), Point2(100, 100)));
+    tree.drain_events();
+
+    for (int round = 0; round < 10; round++)
+    {
+        double x = U(rng), y = U(rng);
+        Box2 window(Point2(x, y), Point2(x + 30, y + 20));
+        std::set<int> expected;
+        for (auto &[id, box] : oracle)
+            if (window.overlap(box))
+                expected.insert(id);
+        auto removed = tree.erase_range(window);
+        EXPECT_EQ(as_set(removed), expected);
+        EXPECT_EQ(removed.size(), expected.size());
+        for (auto id : expected)
+            oracle.erase(id);
+
+        size_t leaves = 0;
+        for (auto &event : tree.drain_events())
+        {
+            EXPECT_EQ(event.query_id, fence);
+            EXPECT_FALSE(event.entered);
+            ++leaves;
+        }
+        EXPECT_EQ(leaves, expected.size());
+        EXPECT_TRUE(tree.query_range(window).empty());
+        EXPECT_EQ(tree.size(), oracle.size());
+        EXPECT_EQ(tree.query_count(Box2(Point2(-1, -1), Point2(200, 200))),
+                  oracle.size());
+    }
+    tree.erase_range(Box2(Point2(-1, -1), Point2(200, 200)));
+    EXPECT_EQ(tree.size(), 0);
+    tree.insert(Box2(Point2(1, 1), Point2(2, 2)), 1);
+    EXPECT_EQ(tree.query_range(Box2(Point2(0, 0), Point2(3, 3))),
+              std::vector<int>{1});
+}
+
+TEST(PackedRTree, MatchesBruteForce)
+{
+    std::mt19937 rng(314551132);
+    std::uniform_real_distribution<double> U(0.0, 1000.0);
+    std::uniform_real_distribution<double> S(0.0, 20.0);
+    for (size_t n : {0, 1, 16, 17, 3000})
+    {
+        std::vector<Box2> boxes;
+        std::vector<int> ids;
+        for (size_t i = 0; i < n; i++)
+        {
+            double x = U(rng), y = U(rng);
+            boxes.push_back(Box2(Point2(x, y), Point2(x + S(rng), y + S(rng))));
+            ids.push_back(static_cast<int>(i));
+        }
+        PackedRTree packed(boxes, ids, 4);
+        EXPECT_EQ(packed.size(), n);
+        for (int q = 0; q < 50; q++)
+        {
+            Box2 query(Point2(U(rng), U(rng)), Point2(U(rng), U(rng)));
+            std::vector<int> expected;
+            for (size_t i = 0; i < n; i++)
+                if (query.overlap(boxes[i]))
+                    expected.push_back(ids[i]);
+            auto hits = packed.query_range(query);
+            EXPECT_EQ(hits.size(), expected.size()); // no duplicates
+            EXPECT_EQ(as_set(hits), as_set(expected));
+        }
+    }
+}
+
+TEST(TemporalRTree, SlidingWindowExpiry)
+{
+    // ten one-second buckets; object i arrives at t = i / 10
+    TemporalRTree temporal(1.0, 10);
+    auto box_of = [](int i) { return Box2(Point2(i, 0), Point2(i + 0.5, 1)); };
+    for (int i = 0; i < 150; i++)
+        temporal.insert(box_of(i), i, i / 10.0);
+    // t = 14.9: buckets 5..14 are live, only the current one is still open
+    EXPECT_EQ(temporal.size(), 100);
+    EXPECT_EQ(temporal.buckets(), 10);
+    EXPECT_EQ(temporal.packed_buckets(), 9);
+
+    Box2 everything(Point2(-1, -1), Point2(1000, 2));
+    std::set<int> live;
+    for (int i = 50; i < 150; i++)
+        live.insert(i);
+    EXPECT_EQ(as_set(temporal.query_range(everything)), live);
+
+    // bucket granularity: [7.5, 8.2] covers buckets 7 and 8
+    std::set<int> window;
+    for (int i = 70; i < 90; i++)
+        window.insert(i);
+    EXPECT_EQ(as_set(temporal.query_range(everything, 7.5, 8.2)), window);
+    Box2 some(Point2(75, 0), Point2(120, 1));
+    std::set<int> some_window;
+    for (int i = 75; i < 90; i++)
+        some_window.insert(i);
+    EXPECT_EQ(as_set(temporal.query_range(some, 7.5, 8.2)), some_window);
+
+    // a late arrival joins its closed bucket, an expired one is ignored
+    temporal.insert(box_of(500), 500, 6.5);
+    temporal.insert(box_of(501), 501, 2.0);
+    EXPECT_EQ(temporal.size(), 101);
+    EXPECT_EQ(as_set(temporal.query_range(box_of(500), 6, 6.9)),
+              std::set<int>{500});
+
+    // jumping ahead expires whole buckets
+    temporal.advance(20.0); // buckets 11..14 remain
+    EXPECT_EQ(temporal.size(), 40);
+    EXPECT_EQ(temporal.buckets(), 4);
+    temporal.advance(100.0);
+    EXPECT_EQ(temporal.size(), 0);
+    EXPECT_TRUE(temporal.query_range(everything).empty());
+}
+
+TEST(TemporalRTree, RejectsBadBucketParameters)
+{
+    EXPECT_THROW(TemporalRTree(1.0, 0), std::invalid_argument);
+    for (double width : {0.0, -1.0, std::numeric_limits<double>::quiet_NaN(),
+                         std::numeric_limits<double>::infinity()})
+        EXPECT_THROW(TemporalRTree(width, 4), std::invalid_argument);
+    TemporalRTree one(0.5, 1);
+    one.insert(Box2(Point2(0, 0), Point2(1, 1)), 7, 3.2);
+    EXPECT_EQ(one.query_range(Box2(Point2(0, 0), Point2(1, 1))),
+              std::vector<int>{7});
+}
+
+TEST(RTreeRadius, MatchesBruteForceWithDistances)
+{
+    std::mt19937 rng(314551132);
+    std::uniform_real_distribution<double> U(0.0, 1000.0);
+    std::uniform_real_distribution<double> S(0.0, 20.0);
+    std::vector<Box2> boxes;
+    std::vector<int> ids;
+    for (int i = 0; i < 3000; i++)
+    {
+        double x = U(rng), y = U(rng);
+        boxes.push_back(Box2(Point2(x, y), Point2(x + S(rng), y + S(rng))));
+        ids.push_back(i);
+    }
+    RTree packed(boxes, ids), dynamic;
+    for (size_t i = 0; i < boxes.size(); i++)
+        dynamic.insert(boxes[i], ids[i]);
+
+    // radii from inside a single box up to the whole data set
+    for (double r : {0.0, 5.0, 60.0, 300.0, 2000.0})
+    {
+        for (int q = 0; q < 10; q++)
+        {
+            Point2 center(U(rng), U(rng));
+            std::map<int, double> expected;
+            for (size_t i = 0; i < boxes.size(); i++)
+            {
+                double d = std::sqrt(boxes[i].min_sq_dist(center));
+                if (d <= r)
+                    expected[ids[i]] = d;
+            }
+            for (const RTree *tree : {&packed, &dynamic})
+            {
+                auto result = tree->query_radius(center, r, true);
+                ASSERT_EQ(result.ids.size(), result.distances.size());
+                std::map<int, double> actual;
+                for (size_t i = 0; i < result.ids.size(); i++)
+                    actual[result.ids[i]] = result.distances[i];
+                ASSERT_EQ(actual.size(), expected.size());
+                for (auto &[id, d] : expected)
+                    EXPECT_NEAR(actual.at(id), d, 1e-9);
+                auto plain = tree->query_radius(center, r);
+                EXPECT_TRUE(plain.distances.empty());
+                EXPECT_EQ(as_set(plain.ids), as_set(result.ids));
+            }
+        }
+    }
+    EXPECT_TRUE(RTree().query_radius(Point2(0, 0), 10).ids.empty());
+
+    // a snapshot keeps answering for its version while the tree mutates
+    Point2 center(500, 500);
+    auto before = dynamic.query_radius(center, 100, true);
+    auto snapshot = dynamic.snapshot();
+    for (int i = 0; i < 1000; i++)
+        dynamic.erase(i);
+    auto frozen = snapshot.query_radius(center, 100, true);
+    EXPECT_EQ(as_set(frozen.ids), as_set(before.ids));
+    EXPECT_EQ(frozen.distances.size(), frozen.ids.size());
+    EXPECT_NE(as_set(dynamic.query_radius(center, 100).ids),
+              as_set(before.ids));
+}
+
+TEST(RTreeTrace, RecordsEveryOperation)
+{
+    auto path = ::testing::TempDir() + "rtse_trace.bin";
+    RTree tree;
+    tree.insert(Box2(Point2(0, 0), Point2(1, 1)), 1, 2.0);
+    tree.start_trace(path);
+    tree.insert(Box2(Point2(2, 2), Point2(3, 3)), 2, 4.5);
+    tree.insert(Box2(Point2(5, 5), Point2(6, 6)), 3);
+    tree.subscribe(Box2(Point2(0, 0), Point2(4, 4))); // not a query record
+    tree.update(1, Box2(Point2(1, 1), Point2(2, 2)));
+    tree.query_range(Box2(Point2(0, 0), Point2(10, 10)));
+    tree.query_range(Box2());
+    tree.erase(2);
+    tree.erase_many({1, 3});
+    tree.stop_trace();
+    tree.insert(Box2(Point2(0, 0), Point2(1, 1)), 4); // not recorded
+
+    auto records = read_trace(path);
+    ASSERT_EQ(records.size(), 9);
+    // the entry present at start_trace() leads as a load record
+    EXPECT_EQ(records[0].op, TraceOp::load);
+    EXPECT_EQ(records[0].id, 1);
+    EXPECT_EQ(records[0].box, Box2(Point2(0, 0), Point2(1, 1)));
+    EXPECT_EQ(records[0].weight, 2.0);
+    EXPECT_EQ(records[1].op, TraceOp::insert);
+    EXPECT_EQ(records[1].id, 2);
+    EXPECT_EQ(records[1].box, Box2(Point2(2, 2), Point2(3, 3)));
+    EXPECT_EQ(records[1].weight, 4.5);
+    EXPECT_EQ(records[3].op, TraceOp::update);
+    EXPECT_EQ(records[3].box, Box2(Point2(1, 1), Point2(2, 2)));
+    EXPECT_EQ(records[4].op, TraceOp::query_range);
+    EXPECT_EQ(records[4].box, Box2(Point2(0, 0), Point2(10, 10)));
+    EXPECT_TRUE(records[5].box.is_empty());
+    EXPECT_EQ(records[6].op, TraceOp::erase);
+    EXPECT_EQ(records[6].id, 2);
+    // the batch delete is recorded as single erases
+    EXPECT_EQ(records[7].op, TraceOp::erase);
+    EXPECT_EQ(records[8].op, TraceOp::erase);
+    EXPECT_EQ(as_set({records[7].id, records[8].id}), (std::set<int>{1, 3}));
+
+    // a truncated file is rejected
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::app);
+        out.put(static_cast<char>(TraceOp::erase));
+    }
+    EXPECT_THROW(read_trace(path), std::runtime_error);
+}
+
+TEST(RTreeCursor, ChunksMatchQueryRangeAcrossMutations)
+{
+    std::mt19937 rng(314551132);
+    std::uniform_real_distribution<double> U(0.0, 1000.0);
+    std::vector<Box2> boxes;
+    std::vector<int> ids;
+    for (int i = 0; i < 5000; i++)
+    {
+        double x = U(rng), y = U(rng);
+        boxes.push_back(Box2(Point2(x, y), Point2(x + 5, y + 5)));
+        ids.push_back(i);
+    }
+    auto tree = std::make_unique<RTree>(boxes, ids);
+    Box2 query(Point2(100, 100), Point2(700, 600));
+    auto expected = tree->query_range(query);
+    ASSERT_GT(expected.size(), 1000);
+
+    auto cursor = tree->query_cursor(query);
+    auto first = cursor.next(100);
+    EXPECT_EQ(first.size(), 100);
+    // mutations and even destroying the tree do not affect the cursor
+    tree->erase_range(query);
+    tree->insert(Box2(Point2(200, 200), Point2(201, 201)), 9999);
+    EXPECT_EQ(tree->query_range(query), std::vector<int>{9999});
+    tree.reset();
+
+    std::vector<int> all = first;
+    while (true)
+    {
+        auto chunk = cursor.next(333);
+        EXPECT_LE(chunk.size(), 333);
+        if (chunk.empty())
+            break;
+        all.insert(all.end(), chunk.begin(), chunk.end());
+    }
+    EXPECT_TRUE(cursor.done());
+    EXPECT_EQ(all.size(), expected.size());
+    EXPECT_EQ(as_set(all), as_set(expected));
+
+    // nothing to visit for a window outside the data
+    RTree other(boxes, ids);
+    auto outside = other.query_cursor(Box2(Point2(-10, -10), Point2(-5, -5)));
+    EXPECT_TRUE(outside.done());
+    EXPECT_TRUE(outside.next(10).empty());
+}
+
+TEST(DiskRTree, MatchesRTreeWithSmallCacheAndReopens)
+{
+    auto path = ::testing::TempDir() + "rtse_disk.idx";
+    std::remove(path.c_str());
+    std::mt19937 rng(314551132);
+    std::uniform_real_distribution<double> U(0.0, 1000.0);
+    std::uniform_real_distribution<double> S(0.0, 20.0);
+    std::vector<Box2> boxes;
+    RTree tree;
+    {
+        // 512-byte pages hold 12 entries; the pool keeps only 8 pages
+        DiskRTree disk(path, 512, 8 * 512);
+        EXPECT_EQ(disk.fanout(), 12);
+        for (int i = 0; i < 4000; i++)
+        {
+            double x = U(rng), y = U(rng);
+            boxes.push_back(Box2(Point2(x, y), Point2(x + S(rng), y + S(rng))));
+            disk.insert(boxes[i], i);
+            tree.insert(boxes[i], i);
+        }
+        EXPECT_GE(disk.height(), 4);
+        for (int i = 0; i < 4000; i += 2)
+        {
+            ASSERT_TRUE(disk.erase(i, boxes[i]));
+            tree.erase(i);
+        }
+        EXPECT_FALSE(disk.erase(0, boxes[0]));
+        EXPECT_FALSE(disk.erase(1, boxes[3]));
+        EXPECT_EQ(disk.size(), 2000);
+
+        disk.reset_page_stats();
+        for (int q = 0; q < 50; q++)
+        {
+            Box2 query(Point2(U(rng), U(rng)), Point2(U(rng), U(rng)));
+            auto ids = disk.query_range(query);
+            EXPECT_EQ(ids.size(), as_set(ids).size());
+            EXPECT_EQ(as_set(ids), as_set(tree.query_range(query)));
+        }
+        auto stats = disk.page_stats();
+        EXPECT_GT(stats.page_reads, 0);
+        EXPECT_LE(stats.cached_pages, 8);
+    }
+
+    // the file keeps the tree; the page size comes from the file
+    DiskRTree reopened(path, 4096);
+    EXPECT_EQ(reopened.page_size(), 512);
+    EXPECT_EQ(reopened.size(), 2000);
+    Box2 everything(Point2(0, 0), Point2(1100, 1100));
+    EXPECT_EQ(as_set(reopened.query_range(everything)),
+              as_set(tree.query_range(everything)));
+    for (int i = 1; i < 4000; i += 2)
+        ASSERT_TRUE(reopened.erase(i, boxes[i]));
+    EXPECT_EQ(reopened.size(), 0);
+    EXPECT_EQ(reopened.height(), 1);
+    EXPECT_TRUE(reopened.query_range(everything).empty());
+    std::remove(path.c_str());
+}
+
+TEST(DiskRTree, RejectsBadPageSizesAndSurvivesFailedReads)
+{
+    auto path = ::testing::TempDir() + "rtse_disk_errors.idx";
+    std::remove(path.c_str());
+    for (size_t page_size : {0, 8, 40, 255, 300})
+        EXPECT_THROW(DiskRTree(path, page_size), std::invalid_argument);
+    EXPECT_FALSE(std::filesystem::exists(path));
+
+    {
+        DiskRTree disk(path, 512, 0);
+        for (int i = 0; i < 500; i++)
+            disk.insert(Box2(Point2(i, i), Point2(i + 1, i + 1)), i);
+    }
+    DiskRTree reopened(path, 512, 0);
+    // cut the file below the root: every read of a lost page fails, and
+    // the frames it was read into go back to the pool
+    std::filesystem::resize_file(path, 3 * 512);
+    Box2 everything(Point2(0, 0), Point2(600, 600));
+    for (int attempt = 0; attempt < 20; attempt++)
+        EXPECT_THROW(reopened.query_range(everything), std::runtime_error);
+    EXPECT_LE(reopened.page_stats().cached_pages, 8);
+    std::remove(path.c_str());
+}
+
+TEST(RTreeParallel, SplitQueriesMatchSerial)
+{
+    std::mt19937 rng(314551132);
+    std::uniform_real_distribution<double> U(0.0, 1000.0);
+    std::vector<Box2> boxes;
+    std::vector<int> ids;
+    for (int i = 0; i < 20000; i++)
+    {
+        double x = U(rng), y = U(rng);
+        boxes.push_back(Box2(Point2(x, y), Point2(x + 3, y + 3)));
+        ids.push_back(i);
+    }
+    RTree serial(boxes, ids), parallel(boxes, ids);
+    parallel.enable_parallel_queries(4, 64);
+
+    std::vector<Box2> queries;
+    for (double side : {5.0, 100.0, 500.0, 1000.0})
+        for (int q = 0; q < 10; q++)
+        {
+            double x = U(rng), y = U(rng);
+            queries.push_back(Box2(Point2(x, y), Point2(x + side, y + side)));
+        }
+    for (auto &query : queries)
+    {
+        auto ids = parallel.query_range(query);
+        EXPECT_EQ(ids.size(), as_set(ids).size());
+        EXPECT_EQ(as_set(ids), as_set(serial.query_range(query)));
+    }
+
+    // concurrent callers share the pool without mixing their results
+    std::vector<std::thread> callers;
+    std::vector<int> ok(4, 1);
+    for (int c = 0; c < 4; c++)
+        callers.emplace_back(
+            [&, c]()
+            {
+                for (size_t q = c; q < queries.size(); q += 4)
+                    if (as_set(parallel.query_range(queries[q])) !=
+                        as_set(serial.query_range(queries[q])))
+                        ok[c] = 0;
+            });
+    for (auto &caller : callers)
+        caller.join();
+    for (int caller_ok : ok)
+        EXPECT_TRUE(caller_ok);
+
+    parallel.enable_parallel_queries(1);
+    EXPECT_EQ(as_set(parallel.query_range(queries.back())),
+              as_set(serial.query_range(queries.back())));
+}
+
+TEST(Box2Primitives, EmptySentinelSemantics)
+{
+    constexpr double inf = std::numeric_limits<double>::infinity();
+    Box2 empty, box(Point2(1, 2), Point2(3, 5));
+    Box2 everything(Point2(-inf, -inf), Point2(inf, inf));
+    EXPECT_EQ(sizeof(Box2), 4 * sizeof(double));
+    EXPECT_TRUE(empty.is_empty());
+    EXPECT_FALSE(box.is_empty());
+    EXPECT_FALSE(everything.is_empty());
+    EXPECT_EQ(empty.area(), 0.0);
+
+    // empty is the identity of merge and overlaps / is contained by nothing
+    EXPECT_EQ(Box2::merge(empty, box), box);
+    EXPECT_EQ(Box2::merge(box, empty), box);
+    EXPECT_TRUE(Box2::merge(empty, empty).is_empty());
+    EXPECT_EQ(empty.enlarge_area(box), box.area());
+    for (const Box2 &other : {box, everything, empty})
+    {
+        EXPECT_FALSE(empty.overlap(other));
+        EXPECT_FALSE(other.overlap(empty));
+        EXPECT_FALSE(empty.contains(other));
+        EXPECT_FALSE(other.contains(empty));
+    }
+    EXPECT_TRUE(everything.overlap(box));
+    EXPECT_TRUE(everything.contains(box));
+    EXPECT_EQ(empty.min_sq_dist(Point2(0, 0)), inf);
+    EXPECT_EQ(empty.max_sq_dist(Point2(0, 0)), inf);
+    EXPECT_EQ(empty, Box2());
+    EXPECT_NE(empty, box);
+
+    RTree tree;
+    tree.insert(box, 1);
+    EXPECT_TRUE(tree.query_range(empty).empty());
+    EXPECT_EQ(tree.query_range(everything), std::vector<int>{1});
+}
+
+TEST(Box2Primitives, FloatBoxRoundsOutwards)
+{
+    std::mt19937 rng(20240917);
+    std::uniform_real_distribution<double> U(-50, 50), S(0, 20);
+    std::vector<Box2> boxes;
+    for (int i = 0; i < 2000; i++)
+    {
+        double x = U(rng), y = U(rng);
+        boxes.push_back(Box2(Point2(x, y), Point2(x + S(rng), y + S(rng))));
+    }
+    for (size_t i = 0; i < boxes.size(); i++)
+    {
+        Box2f compact(boxes[i]);
+        EXPECT_TRUE(compact.to_box2().contains(boxes[i]));
+        // the float test may add false positives but never misses a hit
+        for (size_t j = i + 1; j < std::min(boxes.size(), i + 50); j++)
+            EXPECT_TRUE(!boxes[i].overlap(boxes[j]) ||
+                        compact.overlap(Box2f(boxes[j])));
+    }
+    // touching boxes stay touching after rounding
+    Box2 a(Point2(0.1, 0.1), Point2(0.3, 0.3));
+    Box2 b(Point2(0.3, 0.3), Point2(0.7, 0.7));
+    EXPECT_TRUE(Box2f(a).overlap(Box2f(b)));
+    // beyond the float range the bounds saturate outwards
+    for (const Box2 &huge : {Box2(Point2(-1e300, 1e39), Point2(1e300, 1e300)),
+                             Box2(Point2(-1e39, -1e39), Point2(-1e39, -1e39)),
+                             Box2(Point2(3e38, -3e38), Point2(4e38, 3e38))})
+    {
+        EXPECT_FALSE(Box2f(huge).is_empty());
+        EXPECT_TRUE(Box2f(huge).to_box2().contains(huge));
+        EXPECT_TRUE(Box2f(huge).overlap(Box2f(huge)));
+    }
+    EXPECT_TRUE(Box2f().is_empty());
+    EXPECT_TRUE(Box2f(Box2()).is_empty());
+    EXPECT_TRUE(Box2f(Box2()).to_box2().is_empty());
+    EXPECT_FALSE(Box2f().overlap(Box2f(a)));
+}
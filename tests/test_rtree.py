@@ -53,3 +53,234 @@ def test_random_vs_oracle_small():
         oracle_ids = {i for i, b in oracle.items() if rand_query.overlap(b)}
         tree_idx = set(tree.query_range(rand_query))
         assert oracle_ids == tree_idx
+
+
+def test_bulk_load_and_csv_ingest(tmp_path):
+    import rtse
+
+    boxes = [rtse.Box2(rtse.Point2(i, i), rtse.Point2(i + 1, i + 1)) for i in range(50)]
+    tree = rtse.RTree(boxes, list(range(50)))
+    query = rtse.Box2(rtse.Point2(10, 10), rtse.Point2(12, 12))
+    assert set(tree.query_range(query)) == {9, 10, 11, 12}
+
+    with pytest.raises(ValueError):
+        rtse.RTree(boxes, list(range(49)))
+    with pytest.raises(ValueError):
+        rtse.RTree(boxes, [0] * 50)
+
+    path = tmp_path / "boxes.csv"
+    path.write_text("id,xmin,ymin,xmax,ymax\n1,0,0,1,1\n2,5,5\n")
+    tree = rtse.RTree.from_csv(str(path))
+    assert set(tree.query_range(rtse.Box2(rtse.Point2(0, 0), rtse.Point2(6, 6)))) == {
+        1,
+        2,
+    }
+
+
+def test_snapshot_is_consistent_view():
+    import rtse
+
+    tree = rtse.RTree()
+    box = rtse.Box2(rtse.Point2(0, 0), rtse.Point2(1, 1))
+    tree.insert(box, 1)
+    snap = tree.snapshot()
+    tree.erase(1)
+    tree.insert(box, 2)
+    assert set(snap.query_range(box)) == {1}
+    assert set(tree.query_range(box)) == {2}
+    assert len(snap) == 1
+
+
+def test_subscription_enter_leave_events():
+    import rtse
+
+    tree = rtse.RTree()
+    fence = rtse.Box2(rtse.Point2(0, 0), rtse.Point2(10, 10))
+    tree.insert(rtse.Box2(rtse.Point2(1, 1), rtse.Point2(2, 2)), 1)
+    query_id = tree.subscribe(fence)
+    assert [(e.id, e.entered) for e in tree.drain_events()] == [(1, True)]
+
+    tree.update(1, rtse.Box2(rtse.Point2(3, 3), rtse.Point2(4, 4)))
+    assert tree.drain_events() == []
+    tree.update(1, rtse.Box2(rtse.Point2(20, 20), rtse.Point2(21, 21)))
+    events = tree.drain_events()
+    assert [(e.query_id, e.id, e.entered) for e in events] == [(query_id, 1, False)]
+
+    assert tree.unsubscribe(query_id)
+    assert not tree.unsubscribe(query_id)
+    assert not rtse.RTree().unsubscribe(0)
+
+
+def test_query_cache_counters():
+    import rtse
+
+    tree = rtse.RTree()
+    tree.enable_query_cache(8)
+    window = rtse.Box2(rtse.Point2(0, 0), rtse.Point2(5, 5))
+    tree.insert(rtse.Box2(rtse.Point2(1, 1), rtse.Point2(2, 2)), 1)
+    assert set(tree.query_range(window)) == {1}
+    assert set(tree.query_range(window)) == {1}
+    tree.insert(rtse.Box2(rtse.Point2(3, 3), rtse.Point2(4, 4)), 2)
+    assert set(tree.query_range(window)) == {1, 2}
+    stats = tree.query_cache_stats()
+    assert (stats.hits, stats.misses, stats.invalidations) == (1, 2, 1)
+
+
+def test_grid_index_matches_rtree():
+    import rtse
+    import random
+
+    random.seed(314551132)
+    tree, grid = rtse.RTree(), rtse.GridIndex(cell_capacity=8)
+    for i in range(300):
+        x, y = random.random() * 100, random.random() * 100
+        box = rtse.Box2(rtse.Point2(x, y), rtse.Point2(x + 1, y + 1))
+        tree.insert(box, i)
+        grid.insert(box, i)
+    assert len(grid) == 300
+    for _ in range(20):
+        x, y = random.random() * 90, random.random() * 90
+        query = rtse.Box2(rtse.Point2(x, y), rtse.Point2(x + 10, y + 10))
+        ids = grid.query_range(query)
+        assert len(ids) == len(set(ids))
+        assert set(ids) == set(tree.query_range(query))
+
+
+def test_query_count_and_sum():
+    import rtse
+
+    tree = rtse.RTree()
+    for i in range(40):
+        tree.insert(rtse.Box2(rtse.Point2(i, 0), rtse.Point2(i + 0.5, 1)), i, weight=2.0)
+    query = rtse.Box2(rtse.Point2(0, 0), rtse.Point2(9.9, 1))
+    assert tree.query_count(query) == len(tree.query_range(query)) == 10
+    assert tree.query_sum(query) == 20.0
+
+
+def test_erase_many_and_erase_range():
+    import rtse
+
+    tree = rtse.RTree()
+    for i in range(100):
+        tree.insert(rtse.Box2(rtse.Point2(i, 0), rtse.Point2(i + 0.5, 1)), i)
+    tree.erase_many(list(range(0, 100, 2)))
+    assert len(tree) == 50
+    removed = tree.erase_range(rtse.Box2(rtse.Point2(0, 0), rtse.Point2(49.9, 1)))
+    assert sorted(removed) == list(range(1, 50, 2))
+    everything = rtse.Box2(rtse.Point2(0, 0), rtse.Point2(100, 1))
+    assert sorted(tree.query_range(everything)) == list(range(51, 100, 2))
+
+
+def test_temporal_rtree_expiry():
+    import rtse
+
+    temporal = rtse.TemporalRTree(bucket_width=1.0, num_buckets=5)
+    for i in range(100):
+        temporal.insert(rtse.Box2(rtse.Point2(i, 0), rtse.Point2(i + 0.5, 1)), i, i / 10)
+    assert len(temporal) == 50
+    assert temporal.packed_buckets == 4
+    everything = rtse.Box2(rtse.Point2(0, 0), rtse.Point2(100, 1))
+    assert sorted(temporal.query_range(everything)) == list(range(50, 100))
+    assert sorted(temporal.query_range(everything, 6.0, 6.5)) == list(range(60, 70))
+    temporal.advance(12.0)
+    assert len(temporal) == 20
+    for width, buckets in [(1.0, 0), (0.0, 5), (-1.0, 5), (float("nan"), 5),
+                           (float("inf"), 5)]:
+        with pytest.raises(ValueError):
+            rtse.TemporalRTree(bucket_width=width, num_buckets=buckets)
+
+
+def test_query_radius_numpy():
+    import math
+    import numpy as np
+    import rtse
+
+    tree = rtse.RTree()
+    for i in range(50):
+        tree.insert(rtse.Box2(rtse.Point2(i, 0), rtse.Point2(i, 0)), i)
+    ids = tree.query_radius(rtse.Point2(10, 3), 5.0)
+    assert isinstance(ids, np.ndarray)
+    assert sorted(ids.tolist()) == list(range(6, 15))
+    ids, distances = tree.query_radius(rtse.Point2(10, 3), 5.0, with_distances=True)
+    assert len(ids) == len(distances)
+    for i, d in zip(ids.tolist(), distances.tolist()):
+        assert math.isclose(d, math.hypot(i - 10, 3))
+
+    snap = tree.snapshot()
+    for i in range(50):
+        tree.erase(i)
+    assert sorted(snap.query_radius(rtse.Point2(10, 3), 5.0).tolist()) == list(
+        range(6, 15)
+    )
+    assert len(tree.query_radius(rtse.Point2(10, 3), 5.0)) == 0
+
+
+def test_trace_recording(tmp_path):
+    import rtse
+
+    path = tmp_path / "ops.trace"
+    tree = rtse.RTree()
+    tree.start_trace(str(path))
+    tree.insert(rtse.Box2(rtse.Point2(0, 0), rtse.Point2(1, 1)), 1)
+    tree.query_range(rtse.Box2(rtse.Point2(0, 0), rtse.Point2(2, 2)))
+    tree.stop_trace()
+    data = path.read_bytes()
+    # magic, then a 45-byte insert and a 33-byte query record
+    assert data[:8] == b"RTSETRC1"
+    assert len(data) == 8 + 45 + 33
+
+
+def test_query_cursor_chunks():
+    import rtse
+
+    tree = rtse.RTree()
+    for i in range(1000):
+        tree.insert(rtse.Box2(rtse.Point2(i, 0), rtse.Point2(i + 0.5, 1)), i)
+    query = rtse.Box2(rtse.Point2(100, 0), rtse.Point2(799.9, 1))
+    cursor = tree.query_cursor(query, chunk_size=64)
+    tree.erase(150)  # the cursor keeps iterating the version it started on
+    chunks = list(cursor)
+    assert all(0 < len(chunk) <= 64 for chunk in chunks)
+    ids = [i for chunk in chunks for i in chunk.tolist()]
+    assert sorted(ids) == list(range(100, 800))
+
+
+def test_disk_rtree_roundtrip(tmp_path):
+    import rtse
+
+    path = str(tmp_path / "index.rtse")
+    boxes = [rtse.Box2(rtse.Point2(i, i), rtse.Point2(i + 1, i + 1)) for i in range(500)]
+    disk = rtse.DiskRTree(path, page_size=1024, cache_bytes=8 * 1024)
+    for i, box in enumerate(boxes):
+        disk.insert(box, i)
+    assert disk.fanout == 25
+    assert disk.erase(7, boxes[7])
+    assert not disk.erase(7, boxes[7])
+    disk.flush()
+    del disk
+
+    reopened = rtse.DiskRTree(path)
+    assert len(reopened) == 499
+    query = rtse.Box2(rtse.Point2(5.5, 5.5), rtse.Point2(9.5, 9.5))
+    assert sorted(reopened.query_range(query)) == [5, 6, 8, 9]
+    assert reopened.page_stats().page_reads > 0
+
+    with pytest.raises(ValueError):
+        rtse.DiskRTree(str(tmp_path / "bad.idx"), page_size=0)
+
+
+def test_parallel_query_matches_serial():
+    import rtse
+
+    boxes = [
+        rtse.Box2(rtse.Point2(x, y), rtse.Point2(x + 0.5, y + 0.5))
+        for y in range(100)
+        for x in range(100)
+    ]
+    ids = list(range(10_000))
+    serial, parallel = rtse.RTree(boxes, ids), rtse.RTree(boxes, ids)
+    parallel.enable_parallel_queries(4, task_threshold=32)
+    query = rtse.Box2(rtse.Point2(10, 10), rtse.Point2(80, 90))
+    result = parallel.query_range(query)
+    assert len(result) == len(set(result))
+    assert set(result) == set(serial.query_range(query))
@@ -0,0 +1,120 @@
+// Microbenchmarks of the Box2 primitives and of the R-tree paths built on
+// them (insert with its choose_leaf/split work, packed build, query).
+//
+//   rtse_microbench [N]
+//
+// Every figure is the best of five runs, in nanoseconds per operation.
+#include "../core/rtree.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace rtse;
+using Clock = std::chrono::steady_clock;
+
+// keeps results alive without letting the compiler drop the loops
+static volatile double sink;
+
+template <typename Body> static double best_ns(size_t ops, Body body)
+{
+    double best = 1e300;
+    for (int run = 0; run < 5; run++)
+    {
+        auto t0 = Clock::now();
+        body();
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - t0)
+                        .count();
+        best = std::min(best, ns / ops);
+    }
+    return best;
+}
+
+template <typename Box>
+static size_t count_overlaps(const std::vector<Box> &boxes, const Box &window)
+{
+    size_t hits = 0;
+    for (auto &box : boxes)
+        hits += window.overlap(box);
+    return hits;
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+    std::mt19937 rng(314551132);
+    std::uniform_real_distribution<double> U(0.0, 10000.0);
+    std::uniform_real_distribution<double> S(0.0, 10.0);
+    std::vector<Box2> boxes;
+    std::vector<int> ids;
+    for (size_t i = 0; i < n; i++)
+    {
+        double x = U(rng), y = U(rng);
+        boxes.push_back(Box2(Point2(x, y), Point2(x + S(rng), y + S(rng))));
+        ids.push_back(static_cast<int>(i));
+    }
+    // drawn at run time, so that the compiler cannot fold the window bounds
+    double wx = U(rng) / 2, wy = U(rng) / 2;
+    Box2 window(Point2(wx, wy), Point2(wx + 4000, wy + 4000));
+
+    std::printf("sizeof(Box2) = %zu bytes, N = %zu\n", sizeof(Box2), n);
+    std::printf("%-28s %10s\n", "benchmark", "ns/op");
+    auto report = [](const char *name, double ns)
+    { std::printf("%-28s %10.2f\n", name, ns); };
+
+    std::vector<Box2f> compact(boxes.begin(), boxes.end());
+    report("Box2::overlap",
+           best_ns(n, [&]() { sink = count_overlaps(boxes, window); }));
+    report("Box2f::overlap",
+           best_ns(n, [&]()
+                   { sink = count_overlaps(compact, Box2f(window)); }));
+    report("Box2::merge", best_ns(n, [&]()
+                                  {
+                                      Box2 acc;
+                                      for (auto &box : boxes)
+                                          acc = Box2::merge(acc, box);
+                                      sink = acc.area();
+                                  }));
+    report("Box2::enlarge_area", best_ns(n, [&]()
+                                         {
+                                             double total = 0;
+                                             for (auto &box : boxes)
+                                                 total +=
+                                                     window.enlarge_area(box);
+                                             sink = total;
+                                         }));
+
+    report("RTree::insert", best_ns(n, [&]()
+                                    {
+                                        RTree tree;
+                                        for (size_t i = 0; i < n; i++)
+                                            tree.insert(boxes[i], ids[i]);
+                                        sink = tree.size();
+                                    }));
+    report("RTree packed build / box", best_ns(n, [&]()
+                                               {
+                                                   RTree tree(boxes, ids);
+                                                   sink = tree.size();
+                                               }));
+    RTree tree(boxes, ids);
+    std::vector<Box2> queries;
+    // 1000 x 1000 windows inside the 10000 x 10000 space: 1% of its area
+    std::uniform_real_distribution<double> W(0.0, 9000.0);
+    for (int q = 0; q < 1000; q++)
+    {
+        double x = W(rng), y = W(rng);
+        queries.push_back(Box2(Point2(x, y), Point2(x + 1000, y + 1000)));
+    }
+    report("RTree::query_range 1%", best_ns(queries.size(), [&]()
+                                             {
+                                                 size_t hits = 0;
+                                                 for (auto &query : queries)
+                                                     hits += tree.query_range(
+                                                                     query)
+                                                                 .size();
+                                                 sink = hits;
+                                             }));
+    return 0;
+}
@@ -0,0 +1,276 @@
+// Replays a binary trace recorded with RTree::start_trace() against a fresh
+// index and reports per-operation latency percentiles. The index is first
+// bulk-loaded, untimed, with the trace's leading load records.
+//
+//   rtse_replay <trace> [--threads N] [--index rtree|grid]
+//
+// With several threads the trace is consumed in order from a shared
+// cursor: mutations take an exclusive lock and are applied in trace order,
+// queries take a shared lock and run concurrently. Latencies include the
+// lock wait, so they reflect contention.
+#include "../core/grid_index.h"
+#include "../core/rtree.h"
+#include "../core/trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+using rtse::TraceOp;
+using rtse::TraceRecord;
+using Clock = std::chrono::steady_clock;
+
+static size_t apply(rtse::RTree &index, const TraceRecord &record)
+{
+    switch (record.op)
+    {
+    case TraceOp::insert:
+        index.insert(record.box, record.id, record.weight);
+        return 0;
+    case TraceOp::erase:
+        index.erase(record.id);
+        return 0;
+    case TraceOp::update:
+        index.update(record.id, record.box);
+        return 0;
+    default:
+        return index.query_range(record.box).size();
+    }
+}
+
+static size_t apply(rtse::GridIndex &index, const TraceRecord &record)
+{
+    switch (record.op)
+    {
+    case TraceOp::insert:
+        index.insert(record.box, record.id);
+        return 0;
+    case TraceOp::erase:
+        index.erase(record.id);
+        return 0;
+    case TraceOp::update:
+        index.update(record.id, record.box);
+        return 0;
+    default:
+        return index.query_range(record.box).size();
+    }
+}
+
+// the indexes assert on unknown or repeated ids, so the trace is checked
+// up front: loads must come first, inserted ids must be new, erased and
+// updated ids must be present
+static void check_ids(const std::vector<TraceRecord> &records)
+{
+    std::unordered_set<int> live;
+    bool loading = true;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        auto &record = records[i];
+        auto fail = [&](const char *what)
+        {
+            throw std::runtime_error("record " + std::to_string(i) + ": " +
+                                     what + " " + std::to_string(record.id));
+        };
+        if (record.op == TraceOp::load && !loading)
+            fail("load record after the first operation, id");
+        loading = loading && record.op == TraceOp::load;
+        switch (record.op)
+        {
+        case TraceOp::load:
+        case TraceOp::insert:
+            if (!live.insert(record.id).second)
+                fail("insert of an id already present:");
+            break;
+        case TraceOp::erase:
+            if (live.erase(record.id) == 0)
+                fail("erase of an unknown id:");
+            break;
+        case TraceOp::update:
+            if (live.count(record.id) == 0)
+                fail("update of an unknown id:");
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+static double elapsed_ns(Clock::time_point t0, Clock::time_point t1)
+{
+    return std::chrono::duration<double, std::nano>(t1 - t0).count();
+}
+
+// latency of every record in nanoseconds; hits sums the query result sizes
+template <typename Index>
+static std::vector<double> replay(Index &index,
+                                  const std::vector<TraceRecord> &records,
+                                  unsigned threads, size_t &hits)
+{
+    std::vector<double> latency(records.size());
+    if (threads <= 1)
+    {
+        for (size_t i = 0; i < records.size(); i++)
+        {
+            auto t0 = Clock::now();
+            hits += apply(index, records[i]);
+            latency[i] = elapsed_ns(t0, Clock::now());
+        }
+        return latency;
+    }
+
+    // position of each mutation among the mutations
+    std::vector<size_t> ordinal(records.size());
+    for (size_t i = 0, k = 0; i < records.size(); i++)
+        if (records[i].op != TraceOp::query_range)
+            ordinal[i] = k++;
+
+    std::shared_mutex index_mutex;
+    std::atomic<size_t> next{0}, applied{0}, total_hits{0};
+    auto worker = [&]()
+    {
+        size_t i;
+        while ((i = next.fetch_add(1)) < records.size())
+        {
+            auto &record = records[i];
+            if (record.op == TraceOp::query_range)
+            {
+                auto t0 = Clock::now();
+                std::shared_lock<std::shared_mutex> lock(index_mutex);
+                total_hits += apply(index, record);
+                latency[i] = elapsed_ns(t0, Clock::now());
+                continue;
+            }
+            while (applied.load(std::memory_order_acquire) != ordinal[i])
+                std::this_thread::yield();
+            auto t0 = Clock::now();
+            {
+                std::unique_lock<std::shared_mutex> lock(index_mutex);
+                apply(index, record);
+            }
+            latency[i] = elapsed_ns(t0, Clock::now());
+            applied.fetch_add(1, std::memory_order_release);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; t++)
+        pool.emplace_back(worker);
+    for (auto &th : pool)
+        th.join();
+    hits = total_hits;
+    return latency;
+}
+
+// nearest-rank percentile of sorted values
+static double percentile(const std::vector<double> &sorted, double q)
+{
+    size_t rank = static_cast<size_t>(std::ceil(q * sorted.size()));
+    return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+static int usage()
+{
+    std::fprintf(stderr,
+                 "usage: rtse_replay <trace> [--threads N] "
+                 "[--index rtree|grid]\n");
+    return 2;
+}
+
+int main(int argc, char **argv)
+{
+    std::string path, index = "rtree";
+    unsigned threads = 1;
+    for (int a = 1; a < argc; a++)
+    {
+        std::string arg = argv[a];
+        if (arg == "--threads" && a + 1 < argc)
+            threads = static_cast<unsigned>(std::atoi(argv[++a]));
+        else if (arg == "--index" && a + 1 < argc)
+            index = argv[++a];
+        else if (path.empty() && arg.rfind("--", 0) != 0)
+            path = arg;
+        else
+            return usage();
+    }
+    if (path.empty() || threads == 0 || (index != "rtree" && index != "grid"))
+        return usage();
+
+    std::vector<TraceRecord> records;
+    try
+    {
+        records = rtse::read_trace(path);
+        check_ids(records);
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "rtse_replay: %s: %s\n", path.c_str(), e.what());
+        return 1;
+    }
+
+    // leading load records: the contents of the tree when tracing started
+    std::vector<rtse::Box2> boxes;
+    std::vector<int> ids;
+    std::vector<double> weights;
+    size_t loaded = 0;
+    while (loaded < records.size() && records[loaded].op == TraceOp::load)
+    {
+        boxes.push_back(records[loaded].box);
+        ids.push_back(records[loaded].id);
+        weights.push_back(records[loaded].weight);
+        ++loaded;
+    }
+    records.erase(records.begin(), records.begin() + loaded);
+
+    size_t hits = 0;
+    std::vector<double> latency;
+    Clock::time_point t0;
+    if (index == "grid")
+    {
+        rtse::GridIndex grid(boxes, ids);
+        t0 = Clock::now();
+        latency = replay(grid, records, threads, hits);
+    }
+    else
+    {
+        rtse::RTree tree(boxes, ids, weights);
+        t0 = Clock::now();
+        latency = replay(tree, records, threads, hits);
+    }
+    double wall_ms = elapsed_ns(t0, Clock::now()) / 1e6;
+
+    std::printf("trace %s: %zu ops after loading %zu entries, index %s, "
+                "%u thread(s)\n",
+                path.c_str(), records.size(), loaded, index.c_str(), threads);
+    std::printf("%-12s %10s %10s %10s %10s\n", "op", "count", "p50 us",
+                "p99 us", "p999 us");
+    const std::pair<TraceOp, const char *> ops[] = {
+        {TraceOp::insert, "insert"},
+        {TraceOp::erase, "erase"},
+        {TraceOp::update, "update"},
+        {TraceOp::query_range, "query_range"}};
+    for (auto &[op, name] : ops)
+    {
+        std::vector<double> values;
+        for (size_t i = 0; i < records.size(); i++)
+            if (records[i].op == op)
+                values.push_back(latency[i] / 1e3);
+        if (values.empty())
+            continue;
+        std::sort(values.begin(), values.end());
+        std::printf("%-12s %10zu %10.2f %10.2f %10.2f\n", name, values.size(),
+                    percentile(values, 0.50), percentile(values, 0.99),
+                    percentile(values, 0.999));
+    }
+    std::printf("total %.1f ms, %.0f ops/s, %zu query hits\n", wall_ms,
+                records.size() / (wall_ms / 1e3), hits);
+    return 0;
+}